@@ -0,0 +1,599 @@
+/** @copyright 2025 Sean Kasun */
+
+// Times the LZX decoder on real XNBs, or round trips synthetic sprite
+// data through a small LZX encoder and checks every byte comes back.
+// The encoder mixes verbatim, aligned and uncompressed blocks, with odd
+// lengths and blocks that straddle frames, so the decoder's edge cases
+// get exercised.
+// usage: benchlzx Content/Images [runs]
+//        benchlzx --roundtrip [bytes] [seed]
+
+#include "handle.h"
+#include "lzx.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+static const int WindowBits = 16;
+static const int Window = 1 << WindowBits;
+static const int Frame = 0x8000;
+static const int PositionSlots = 32;
+static const int MainSize = 256 + PositionSlots * 8;
+static const int LengthSize = 249;
+static const int AlignedSize = 8;
+static const int PreTreeSize = 20;
+static const int MinMatch = 2, MaxMatch = 257;
+static const int ChainDepth = 8;
+
+static const uint8_t extraBits[] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+  12, 12, 13, 13, 14, 14,
+};
+static const uint32_t positionBase[] = {
+  0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768,
+  1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152,
+};
+
+// the same frame loop Textures::decode runs
+static bool decodeFrames(const uint8_t *p, const uint8_t *endp, uint8_t *raw, uint32_t length) {
+  uint8_t *dp = raw;
+  struct LZXstate *lzx = LZXinit(WindowBits);
+  bool ok = true;
+  while (p < endp) {
+    uint8_t hi = *p++;
+    uint8_t lo = *p++;
+    uint16_t compLen = (hi << 8) | lo;
+    uint16_t decompLen = Frame;
+    if (hi == 0xff) {
+      hi = lo;
+      lo = *p++;
+      decompLen = (hi << 8) | lo;
+      hi = *p++;
+      lo = *p++;
+      compLen = (hi << 8) | lo;
+    }
+    if (compLen == 0 || decompLen == 0) {
+      break;
+    }
+    if (p + compLen > endp || dp + decompLen > raw + length ||
+        LZXdecompress(lzx, const_cast<uint8_t *>(p), dp, compLen, decompLen) != DECR_OK) {
+      ok = false;
+      break;
+    }
+    p += compLen;
+    dp += decompLen;
+  }
+  LZXteardown(lzx);
+  return ok && dp == raw + length;
+}
+
+// msb first, packed into little endian 16 bit words like the decoder reads
+class BitWriter {
+  public:
+    void put(uint32_t value, int bits) {
+      for (int i = bits - 1; i >= 0; i--) {
+        acc = (acc << 1) | ((value >> i) & 1);
+        if (++count == 16) {
+          out.push_back(acc & 0xff);
+          out.push_back(acc >> 8);
+          acc = count = 0;
+        }
+      }
+    }
+    void align() {
+      if (count) {
+        put(0, 16 - count);
+      }
+    }
+    bool aligned() const {
+      return count == 0;
+    }
+    void raw(const uint8_t *data, size_t len) {
+      out.insert(out.end(), data, data + len);
+    }
+    std::vector<uint8_t> out;
+
+  private:
+    uint32_t acc = 0;
+    int count = 0;
+};
+
+// huffman code lengths no longer than limit, flattening the counts until they fit
+static std::vector<uint8_t> codeLengths(std::vector<uint32_t> freq, int limit) {
+  while (true) {
+    std::vector<int> syms;
+    for (size_t i = 0; i < freq.size(); i++) {
+      if (freq[i]) {
+        syms.push_back(i);
+      }
+    }
+    std::vector<uint8_t> lens(freq.size(), 0);
+    if (syms.empty()) {
+      return lens;
+    }
+    if (syms.size() == 1) {  // a tree needs two leaves
+      int other = syms[0] == 0 ? 1 : 0;
+      freq[other] = 1;
+      syms.push_back(other);
+    }
+    std::vector<int> parent(syms.size(), -1);
+    using Node = std::pair<uint64_t, int>;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+    for (size_t i = 0; i < syms.size(); i++) {
+      queue.push({freq[syms[i]], i});
+    }
+    while (queue.size() > 1) {
+      auto a = queue.top();
+      queue.pop();
+      auto b = queue.top();
+      queue.pop();
+      parent.push_back(-1);
+      parent[a.second] = parent[b.second] = parent.size() - 1;
+      queue.push({a.first + b.first, static_cast<int>(parent.size() - 1)});
+    }
+    int longest = 0;
+    for (size_t i = 0; i < syms.size(); i++) {
+      int depth = 0;
+      for (int n = i; parent[n] >= 0; n = parent[n]) {
+        depth++;
+      }
+      lens[syms[i]] = depth;
+      longest = std::max(longest, depth);
+    }
+    if (longest <= limit) {
+      return lens;
+    }
+    for (auto &f : freq) {
+      f = f ? (f >> 1) | 1 : 0;
+    }
+  }
+}
+
+static std::vector<uint32_t> canonicalCodes(const std::vector<uint8_t> &lens) {
+  std::vector<uint32_t> codes(lens.size(), 0);
+  uint32_t code = 0;
+  int prev = 0;
+  for (int len = 1; len <= 16; len++) {
+    for (size_t sym = 0; sym < lens.size(); sym++) {
+      if (lens[sym] == len) {
+        code <<= len - prev;
+        prev = len;
+        codes[sym] = code++;
+      }
+    }
+  }
+  return codes;
+}
+
+class Encoder {
+  public:
+    Encoder(const std::vector<uint8_t> &data, uint32_t seed) : data(data), rng(seed),
+        head(1 << 16, -1), chain(data.size(), -1), mainPrev(MainSize, 0), lengthPrev(LengthSize, 0) {}
+
+    // XNB style frames: a 2 byte big endian compressed length, or 0xff
+    // then the decompressed and compressed lengths for a short frame
+    std::vector<uint8_t> encode() {
+      bits.put(0, 1);  // no intel e8 translation
+      size_t pos = 0;
+      while (pos < data.size()) {
+        static const int types[] = {1, 1, 2, 2, 3};
+        int type = types[rng() % 5];
+        size_t size = std::min<size_t>(1000 + rng() % 89000, data.size() - pos);
+        if (type == 3) {
+          // uncompressed blocks can't cross a frame, and can't end one on an odd byte
+          size_t frameEnd = (pos / Frame + 1) * Frame;
+          size = std::min(size, frameEnd - pos);
+          if ((pos + size) % Frame == 0 && (size & 1)) {
+            size--;
+          }
+          if (size == 0) {
+            continue;
+          }
+          uncompressed(pos, size);
+        } else {
+          compressed(type == 2, pos, size);
+        }
+        pos += size;
+      }
+      return out;
+    }
+
+  private:
+    struct Symbol {
+      int main, footer, slot;
+      uint32_t offset;
+      int length;
+    };
+
+    void advance(int len) {
+      written += len;
+      if (written % Frame == 0 || written == data.size()) {
+        bits.align();
+        size_t frameLen = written - frames * Frame;
+        size_t compLen = bits.out.size();
+        if (frameLen != Frame) {
+          out.push_back(0xff);
+          out.push_back(frameLen >> 8);
+          out.push_back(frameLen & 0xff);
+        }
+        out.push_back(compLen >> 8);
+        out.push_back(compLen & 0xff);
+        out.insert(out.end(), bits.out.begin(), bits.out.end());
+        bits = BitWriter();
+        frames++;
+      }
+    }
+
+    void uncompressed(size_t pos, size_t size) {
+      bits.put(3, 3);
+      bits.put(size >> 8, 16);
+      bits.put(size & 0xff, 8);
+      if (bits.aligned()) {
+        bits.put(0, 16);
+      } else {
+        bits.align();
+      }
+      for (uint32_t r : repeats) {
+        uint8_t le[] = {static_cast<uint8_t>(r), static_cast<uint8_t>(r >> 8),
+          static_cast<uint8_t>(r >> 16), static_cast<uint8_t>(r >> 24)};
+        bits.raw(le, 4);
+      }
+      bits.raw(data.data() + pos, size);
+      if (size & 1) {
+        uint8_t pad = 0;
+        bits.raw(&pad, 1);
+      }
+      advance(size);
+    }
+
+    void compressed(bool alignedBlock, size_t pos, size_t size) {
+      bits.put(alignedBlock ? 2 : 1, 3);
+      bits.put(size >> 8, 16);
+      bits.put(size & 0xff, 8);
+
+      std::vector<Symbol> syms;
+      uint32_t rr[3] = {repeats[0], repeats[1], repeats[2]};
+      for (size_t p = pos, end = pos + size; p < end;) {
+        // matches never cross a frame
+        size_t frameEnd = std::min((p / Frame + 1) * Frame, end);
+        parse(p, frameEnd, rr, syms);
+        p = frameEnd;
+      }
+
+      std::vector<uint32_t> mainFreq(MainSize, 0), lengthFreq(LengthSize, 0), alignedFreq(AlignedSize, 0);
+      for (const auto &s : syms) {
+        mainFreq[s.main]++;
+        if (s.footer >= 0) {
+          lengthFreq[s.footer]++;
+        }
+        if (s.slot > 2 && extraBits[s.slot] >= 3) {
+          alignedFreq[(s.offset + 2 - positionBase[s.slot]) & 7]++;
+        }
+      }
+      std::vector<uint8_t> alignedLens, mainLens, lengthLens;
+      std::vector<uint32_t> alignedCodes;
+      if (alignedBlock) {
+        alignedLens = codeLengths(alignedFreq, 7);
+        alignedCodes = canonicalCodes(alignedLens);
+        for (auto len : alignedLens) {
+          bits.put(len, 3);
+        }
+      }
+      mainLens = codeLengths(mainFreq, 16);
+      lengthLens = codeLengths(lengthFreq, 16);
+      auto mainCodes = canonicalCodes(mainLens);
+      auto lengthCodes = canonicalCodes(lengthLens);
+      writeLengths(mainPrev, mainLens, 0, 256);
+      writeLengths(mainPrev, mainLens, 256, MainSize);
+      writeLengths(lengthPrev, lengthLens, 0, LengthSize);
+
+      for (const auto &s : syms) {
+        bits.put(mainCodes[s.main], mainLens[s.main]);
+        if (s.footer >= 0) {
+          bits.put(lengthCodes[s.footer], lengthLens[s.footer]);
+        }
+        if (s.slot > 2) {
+          int extra = extraBits[s.slot];
+          uint32_t verbatim = s.offset + 2 - positionBase[s.slot];
+          if (alignedBlock && extra >= 3) {
+            if (extra > 3) {
+              bits.put(verbatim >> 3, extra - 3);
+            }
+            bits.put(alignedCodes[verbatim & 7], alignedLens[verbatim & 7]);
+          } else if (extra) {
+            bits.put(verbatim, extra);
+          }
+        }
+        advance(s.length);
+      }
+      std::copy(rr, rr + 3, repeats);
+    }
+
+    // greedy LZ77 over [start, end), tracking the repeated offsets as we go
+    void parse(size_t start, size_t end, uint32_t rr[3], std::vector<Symbol> &syms) {
+      auto hash = [this](size_t i) {
+        return (data[i] << 8 ^ data[i + 1] << 4 ^ data[i + 2]) & 0xffff;
+      };
+      auto insert = [&](size_t i) {
+        if (i + 3 <= end) {
+          int h = hash(i);
+          chain[i] = head[h];
+          head[h] = i;
+        }
+      };
+      for (size_t i = start; i < end;) {
+        int best = 0;
+        uint32_t bestOffset = 0;
+        if (i + 3 <= end) {
+          int depth = 0;
+          for (int cand = head[hash(i)]; cand >= 0 && depth < ChainDepth; cand = chain[cand], depth++) {
+            uint32_t offset = i - cand;
+            if (offset >= Window - 3) {
+              break;
+            }
+            int len = 0, most = std::min<size_t>(MaxMatch, end - i);
+            while (len < most && data[cand + len] == data[i + len]) {
+              len++;
+            }
+            if (len > best) {
+              best = len;
+              bestOffset = offset;
+            }
+          }
+        }
+        bool repeat = bestOffset == rr[0] || bestOffset == rr[1] || bestOffset == rr[2];
+        if (best >= 3 || (best == MinMatch && repeat)) {
+          for (int j = 0; j < best; j++) {
+            insert(i + j);
+          }
+          syms.push_back(match(best, bestOffset, rr));
+          i += best;
+        } else {
+          insert(i);
+          syms.push_back({data[i], -1, -1, 0, 1});
+          i++;
+        }
+      }
+    }
+
+    Symbol match(int len, uint32_t offset, uint32_t rr[3]) {
+      int slot;
+      if (offset == rr[0]) {
+        slot = 0;
+      } else if (offset == rr[1]) {
+        slot = 1;
+        std::swap(rr[0], rr[1]);
+      } else if (offset == rr[2]) {
+        slot = 2;
+        std::swap(rr[0], rr[2]);
+      } else {
+        slot = std::upper_bound(positionBase, positionBase + PositionSlots, offset + 2) - positionBase - 1;
+        rr[2] = rr[1];
+        rr[1] = rr[0];
+        rr[0] = offset;
+      }
+      int header = std::min(len - MinMatch, 7);
+      int footer = header == 7 ? len - MinMatch - 7 : -1;
+      return {256 + (slot << 3 | header), footer, slot, offset, len};
+    }
+
+    // a pretree, then the lengths as deltas from the last block's, with
+    // runs of zeros and repeats
+    void writeLengths(std::vector<uint8_t> &prev, const std::vector<uint8_t> &lens, int first, int last) {
+      struct Op {
+        int code, extra, extraBits, same;
+      };
+      std::vector<Op> ops;
+      for (int x = first; x < last;) {
+        if (lens[x] == 0) {
+          int run = 0;
+          while (x + run < last && lens[x + run] == 0) {
+            run++;
+          }
+          if (run >= 20) {
+            run = std::min(run, 51);
+            ops.push_back({18, run - 20, 5, 0});
+            x += run;
+            continue;
+          }
+          if (run >= 4) {
+            ops.push_back({17, run - 4, 4, 0});
+            x += run;
+            continue;
+          }
+        }
+        int run = 0;
+        while (x + run < last && lens[x + run] == lens[x] && run < 5) {
+          run++;
+        }
+        int delta = (prev[x] - lens[x] + 17) % 17;
+        if (run >= 4 && (rng() & 1)) {
+          ops.push_back({19, run - 4, 1, delta});
+          x += run;
+          continue;
+        }
+        ops.push_back({delta, 0, 0, 0});
+        x++;
+      }
+      std::vector<uint32_t> freq(PreTreeSize, 0);
+      for (const auto &op : ops) {
+        freq[op.code]++;
+        if (op.code == 19) {
+          freq[op.same]++;
+        }
+      }
+      auto preLens = codeLengths(freq, 15);
+      auto preCodes = canonicalCodes(preLens);
+      for (auto len : preLens) {
+        bits.put(len, 4);
+      }
+      for (const auto &op : ops) {
+        bits.put(preCodes[op.code], preLens[op.code]);
+        if (op.code >= 17) {
+          bits.put(op.extra, op.extraBits);
+        }
+        if (op.code == 19) {
+          bits.put(preCodes[op.same], preLens[op.same]);
+        }
+      }
+      std::copy(lens.begin() + first, lens.begin() + last, prev.begin() + first);
+    }
+
+    const std::vector<uint8_t> &data;
+    std::mt19937 rng;
+    std::vector<int> head, chain;
+    std::vector<uint8_t> mainPrev, lengthPrev;
+    uint32_t repeats[3] = {1, 1, 1};
+    BitWriter bits;
+    std::vector<uint8_t> out;
+    size_t written = 0, frames = 0;
+};
+
+// sprite-like RGBA: transparent runs and small palettes, with some noise
+static std::vector<uint8_t> makeSprites(size_t bytes, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> out;
+  static const int widths[] = {16, 32, 48, 64, 128}, heights[] = {16, 32, 64, 256};
+  while (out.size() < bytes) {
+    int w = widths[rng() % 5], h = heights[rng() % 4];
+    std::vector<uint32_t> palette(2 + rng() % 11);
+    for (auto &c : palette) {
+      c = (rng() & 0xffffff) | 0xff000000;
+    }
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w;) {
+        int run = std::min<int>(1 + rng() % 12, w - x);
+        uint32_t c = rng() % 100 < 40 ? 0 : palette[rng() % palette.size()];
+        if (rng() % 100 < 5) {
+          c = rng();
+        }
+        for (int i = 0; i < run; i++, x++) {
+          for (int b = 0; b < 4; b++) {
+            out.push_back(c >> (b * 8));
+          }
+        }
+      }
+    }
+  }
+  out.resize(bytes);
+  return out;
+}
+
+template <class F> static double best(int runs, F f) {
+  double fastest = 1e30;
+  for (int i = 0; i < runs; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    fastest = std::min(fastest, std::chrono::duration<double>(end - start).count());
+  }
+  return fastest;
+}
+
+static int roundTrip(size_t bytes, uint32_t seed) {
+  auto data = makeSprites(bytes, seed);
+  Encoder encoder(data, seed);
+  auto frames = encoder.encode();
+  frames.resize(frames.size() + 16, 0);  // the decoder reads a little past the end
+  std::vector<uint8_t> decoded(data.size());
+  if (!decodeFrames(frames.data(), frames.data() + frames.size() - 16, decoded.data(), decoded.size())) {
+    printf("seed %u: decoder failed\n", seed);
+    return 1;
+  }
+  if (decoded != data) {
+    auto at = std::mismatch(decoded.begin(), decoded.end(), data.begin()).first - decoded.begin();
+    printf("seed %u: differs at byte %zu\n", seed, static_cast<size_t>(at));
+    return 1;
+  }
+  double secs = best(5, [&]() {
+    decodeFrames(frames.data(), frames.data() + frames.size() - 16, decoded.data(), decoded.size());
+  });
+  printf("seed %u: %zu -> %zu bytes, round trip ok, %.1f MB/s\n", seed, data.size(), frames.size() - 16,
+         data.size() / secs / 1e6);
+  return 0;
+}
+
+struct Compressed {
+  std::string name;
+  std::unique_ptr<Handle> handle;
+  const uint8_t *data;
+  uint32_t length, decompLength;
+};
+
+static int folder(const std::filesystem::path &path, int runs) {
+  std::vector<Compressed> files;
+  uint64_t compBytes = 0, decompBytes = 0;
+  uint32_t largest = 0;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator(path, ec)) {
+    if (entry.path().extension() != ".xnb") {
+      continue;
+    }
+    auto handle = std::make_unique<Handle>(entry.path().string());
+    if (!handle->isOpen()) {
+      continue;
+    }
+    try {
+      auto header = handle->r32();
+      if (header != 0x77424e58 && header != 0x78424e58 && header != 0x6d424e58) {
+        continue;
+      }
+      if (!(handle->r16() & 0x8000)) {
+        continue;  // stored uncompressed, nothing to time
+      }
+      int64_t length = handle->r32();  // the whole file
+      uint32_t decompLength = handle->r32();
+      length -= handle->tell();
+      const uint8_t *data = handle->readBytes(length);
+      compBytes += length;
+      decompBytes += decompLength;
+      largest = std::max(largest, decompLength);
+      files.push_back({entry.path().filename().string(), std::move(handle), data, static_cast<uint32_t>(length), decompLength});
+    } catch (HandleError &e) {
+      printf("%s: %s\n", entry.path().filename().string().c_str(), e.reason.c_str());
+    }
+  }
+  if (ec || files.empty()) {
+    printf("No compressed XNBs in %s\n", path.string().c_str());
+    return 1;
+  }
+
+  std::vector<uint8_t> raw(largest);
+  int failed = 0;
+  for (const auto &file : files) {
+    if (!decodeFrames(file.data, file.data + file.length, raw.data(), file.decompLength)) {
+      printf("%s: failed to decode\n", file.name.c_str());
+      failed++;
+    }
+  }
+  double secs = best(runs, [&]() {
+    for (const auto &file : files) {
+      decodeFrames(file.data, file.data + file.length, raw.data(), file.decompLength);
+    }
+  });
+  printf("%zu files, %.1f MB -> %.1f MB, %d failed\n", files.size(), compBytes / 1e6, decompBytes / 1e6, failed);
+  printf("%.1f MB/s\n", decompBytes / secs / 1e6);
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && strcmp(argv[1], "--roundtrip") == 0) {
+    size_t bytes = argc > 2 ? strtoull(argv[2], nullptr, 10) : 8 << 20;
+    uint32_t seed = argc > 3 ? strtoul(argv[3], nullptr, 10) : 1;
+    return roundTrip(bytes, seed);
+  }
+  if (argc < 2) {
+    printf("usage: benchlzx Content/Images [runs]\n");
+    printf("       benchlzx --roundtrip [bytes] [seed]\n");
+    return 1;
+  }
+  return folder(argv[1], argc > 2 ? atoi(argv[2]) : 3);
+}
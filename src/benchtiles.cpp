@@ -0,0 +1,305 @@
+/** @copyright 2025 Sean Kasun */
+
+// Times Tile::load and Tile::skip against a byte-at-a-time reference
+// decoder, over a synthetic tile stream shaped like a real world's, or
+// over the tiles of an actual world file.
+// usage: benchtiles [records]
+//        benchtiles world.wld tilesWide tilesHigh
+
+#include "tiles.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+static const int NumTypes = 693;
+
+struct Reference {
+  int16_t u = 0, v = 0, type = 0, wall = 0;
+  uint8_t liquid = 0, paint = 0, wallPaint = 0, slope = 0;
+  uint16_t is = 0;
+};
+
+// the decoder Tile::load replaced: a Handle read and a branch per field,
+// with frame important types in a std::vector<bool>
+static int referenceLoad(Handle &handle, const std::vector<bool> &extra, Reference &tile) {
+  tile = Reference();
+  uint8_t flags1 = handle.r8<false>();
+  uint8_t flags2 = flags1 & 1 ? handle.r8<false>() : 0;
+  uint8_t flags3 = flags2 & 1 ? handle.r8<false>() : 0;
+  if (flags3 & 1) {
+    handle.r8<false>();
+  }
+  if (flags1 & 2) {
+    tile.is = IsActive;
+    tile.type = handle.r8<false>();
+    if (flags1 & 0x20) {
+      tile.type |= handle.r8<false>() << 8;
+    }
+    if (tile.type < 0 || tile.type >= static_cast<int>(extra.size())) {
+      return -1;
+    }
+    if (extra[tile.type]) {
+      tile.u = handle.r16<false>();
+      tile.v = handle.r16<false>();
+    } else {
+      tile.u = tile.v = -1;
+    }
+    if (flags3 & 8) {
+      tile.paint = handle.r8<false>();
+    }
+  }
+  if (flags1 & 4) {
+    tile.wall = handle.r8<false>();
+    if (flags3 & 0x10) {
+      tile.wallPaint = handle.r8<false>();
+    }
+  }
+  if (flags1 & 0x18) {
+    tile.liquid = handle.r8<false>();
+    if ((flags1 & 0x18) == 0x18) {
+      tile.is |= IsHoney;
+    } else if (flags1 & 0x10) {
+      tile.is |= IsLava;
+    }
+    if (flags3 & 0x80) {
+      tile.is |= IsShimmer;
+    }
+  }
+  if (flags2 & 2) {
+    tile.is |= IsRedWire;
+  }
+  if (flags2 & 4) {
+    tile.is |= IsBlueWire;
+  }
+  if (flags2 & 8) {
+    tile.is |= IsGreenWire;
+  }
+  if (flags3 & 0x20) {
+    tile.is |= IsYellowWire;
+  }
+  int slope = flags2 >> 4;
+  if (slope > 1) {
+    tile.slope = slope - 1;
+  } else if (slope == 1) {
+    tile.is |= IsHalf;
+  }
+  if (flags3 & 2) {
+    tile.is |= IsActuator;
+  }
+  if (flags3 & 4) {
+    tile.is |= IsInactive;
+  }
+  if (flags3 & 0x40) {
+    tile.wall |= handle.r8<false>() << 8;
+  }
+  switch (flags1 >> 6) {
+    case 1:
+      return handle.r8<false>();
+    case 2:
+      return handle.r16<false>();
+  }
+  return 0;
+}
+
+// mostly air, stone and dirt with walls behind, a sprinkling of
+// furniture, wires and liquid.  Neighbours in a column tend to look
+// alike, so most records repeat the shape of the one before.
+static std::vector<uint8_t> makeStream(int records, std::vector<uint8_t> &important) {
+  std::mt19937 rng(1);
+  auto chance = [&](int percent) {
+    return static_cast<int>(rng() % 100) < percent;
+  };
+  important.assign((NumTypes + 7) / 8, 0);
+  for (int type = 0; type < NumTypes; type++) {
+    if (type > 3 && chance(30)) {
+      important[type >> 3] |= 1 << (type & 7);
+    }
+  }
+  std::vector<uint8_t> out;
+  uint8_t flags1 = 0, flags2 = 0, flags3 = 0;
+  bool active = false, wall = false, liquid = false;
+  int type = 0, rle = 0;
+  for (int i = 0; i < records; i++) {
+    if (i == 0 || chance(25)) {
+      flags1 = flags2 = flags3 = 0;
+      active = chance(60);
+      wall = chance(50);
+      liquid = chance(8);
+      type = chance(80) ? rng() % 4 : rng() % NumTypes;
+      rle = chance(40) ? (chance(90) ? 1 + rng() % 40 : 256 + rng() % 2000) : 0;
+      flags1 |= active ? 2 : 0;
+      flags1 |= wall ? 4 : 0;
+      flags1 |= liquid ? (chance(80) ? 8 : chance(50) ? 0x10 : 0x18) : 0;
+      flags1 |= active && type > 255 ? 0x20 : 0;
+      flags1 |= rle == 0 ? 0 : rle < 256 ? 0x40 : 0x80;
+      if (chance(15)) {
+        flags2 = rng() & 0xfe;
+      }
+      if (chance(10)) {
+        flags3 = rng() & 0xbe;  // no flags4, and walls stay under 256
+        flags2 |= 1;
+      }
+      if (flags2) {
+        flags1 |= 1;
+      }
+    }
+    out.push_back(flags1);
+    if (flags1 & 1) {
+      out.push_back(flags2);
+    }
+    if (flags2 & 1) {
+      out.push_back(flags3);
+    }
+    if (active) {
+      out.push_back(type & 0xff);
+      if (type > 255) {
+        out.push_back(type >> 8);
+      }
+      if ((important[type >> 3] >> (type & 7)) & 1) {
+        for (int b = 0; b < 4; b++) {
+          out.push_back(rng() % 8 * (b & 1 ? 0 : 18));
+        }
+      }
+      if (flags3 & 8) {
+        out.push_back(rng() % 31);
+      }
+    }
+    if (wall) {
+      out.push_back(1 + rng() % 200);
+      if (flags3 & 0x10) {
+        out.push_back(rng() % 31);
+      }
+    }
+    if (liquid) {
+      out.push_back(rng());
+    }
+    if (rle) {
+      out.push_back(rle & 0xff);
+      if (rle > 255) {
+        out.push_back(rle >> 8);
+      }
+    }
+  }
+  return out;
+}
+
+template <class F> static double best(int runs, F f) {
+  double fastest = 1e30;
+  for (int i = 0; i < runs; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    fastest = std::min(fastest, std::chrono::duration<double, std::nano>(end - start).count());
+  }
+  return fastest;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<uint8_t> stream;
+  FrameImportant extra;
+  int records = 0;
+  std::unique_ptr<Handle> world;
+  if (argc > 3) {
+    world = std::make_unique<Handle>(argv[1]);
+    if (!world->isOpen()) {
+      printf("Couldn't open %s\n", argv[1]);
+      return 1;
+    }
+    int tilesWide = atoi(argv[2]), tilesHigh = atoi(argv[3]);
+    std::vector<int64_t> sections;
+    try {
+      world->r32();  // version
+      world->read(7);  // relogic
+      world->r8();  // file type
+      world->r32();  // revision
+      world->r64();  // favorite
+      int numSections = world->r16();
+      for (int i = 0; i < numSections; i++) {
+        sections.push_back(world->r32());
+      }
+      extra.load(*world);
+      world->seek(sections[1]);
+      const uint8_t *start = world->cursor();
+      for (int x = 0; x < tilesWide; x++) {
+        for (int y = 0; y < tilesHigh; y++, records++) {
+          y += Tile::skip(*world, extra);
+        }
+      }
+      stream.assign(start, world->cursor());
+    } catch (HandleError &e) {
+      printf("Bad world: %s\n", e.reason.c_str());
+      return 1;
+    }
+  } else {
+    records = argc > 1 ? atoi(argv[1]) : 2000000;
+    std::vector<uint8_t> important;
+    stream = makeStream(records, important);
+    std::vector<uint8_t> header = {NumTypes & 0xff, NumTypes >> 8};
+    header.insert(header.end(), important.begin(), important.end());
+    Handle headerHandle(header.data(), header.size());
+    extra.load(headerHandle);
+  }
+
+  std::vector<bool> extraBools(extra.size());
+  for (int type = 0; type < extra.size(); type++) {
+    extraBools[type] = extra[type];
+  }
+
+  // check they agree before timing anything
+  Handle handle(stream.data(), stream.size());
+  Handle refHandle(stream.data(), stream.size());
+  for (int i = 0; i < records; i++) {
+    Tile tile;
+    Reference ref;
+    int rle = tile.load(handle, extra);
+    int refRle = referenceLoad(refHandle, extraBools, ref);
+    bool same = rle == refRle && tile.Is() == ref.is && tile.slope == ref.slope &&
+      handle.tell() == refHandle.tell();
+    if (ref.is & IsActive) {
+      same = same && tile.type == ref.type && tile.u == ref.u && tile.v == ref.v && tile.paint == ref.paint;
+    }
+    if (ref.wall) {
+      same = same && tile.wall == ref.wall && tile.wallPaint == ref.wallPaint;
+    }
+    if (ref.is & (IsLava | IsHoney) || ref.liquid) {
+      same = same && tile.liquid == ref.liquid;
+    }
+    if (!same) {
+      printf("record %d decoded differently\n", i);
+      return 1;
+    }
+  }
+
+  int runs = 20;
+  int sink = 0;
+  double reference = best(runs, [&]() {
+    Handle handle(stream.data(), stream.size());
+    Reference ref;
+    for (int i = 0; i < records; i++) {
+      sink += referenceLoad(handle, extraBools, ref);
+    }
+  });
+  double load = best(runs, [&]() {
+    Handle handle(stream.data(), stream.size());
+    Tile tile;
+    for (int i = 0; i < records; i++) {
+      sink += tile.load(handle, extra);
+    }
+  });
+  double skip = best(runs, [&]() {
+    Handle handle(stream.data(), stream.size());
+    for (int i = 0; i < records; i++) {
+      sink += Tile::skip(handle, extra);
+    }
+  });
+  printf("%d records, %zu bytes (%d)\n", records, stream.size(), sink & 1);
+  printf("reference  %6.2f ns/record\n", reference / records);
+  printf("Tile::load %6.2f ns/record\n", load / records);
+  printf("Tile::skip %6.2f ns/record\n", skip / records);
+  return 0;
+}
@@ -0,0 +1,44 @@
+/** @copyright 2025 Sean Kasun */
+
+#include "bufferheap.h"
+#include <iterator>
+
+void BufferHeap::reset(uint32_t size) {
+  holes.clear();
+  holes[0] = size;
+  inUse = 0;
+}
+
+bool BufferHeap::alloc(uint32_t size, uint32_t *offset) {
+  for (auto it = holes.begin(); it != holes.end(); ++it) {
+    if (it->second < size) {
+      continue;
+    }
+    *offset = it->first;
+    uint32_t left = it->second - size;
+    holes.erase(it);
+    if (left > 0) {
+      holes[*offset + size] = left;
+    }
+    inUse += size;
+    return true;
+  }
+  return false;
+}
+
+void BufferHeap::free(uint32_t offset, uint32_t size) {
+  inUse -= size;
+  auto next = holes.lower_bound(offset);
+  if (next != holes.end() && offset + size == next->first) {
+    size += next->second;
+    next = holes.erase(next);
+  }
+  if (next != holes.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += size;
+      return;
+    }
+  }
+  holes[offset] = size;
+}
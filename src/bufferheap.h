@@ -0,0 +1,21 @@
+/** @copyright 2025 Sean Kasun */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+// Hands out ranges of a fixed size gpu buffer.  First fit, and freed ranges
+// are merged with their neighbours so big chunks can reuse the space.
+class BufferHeap {
+  public:
+    void reset(uint32_t size);
+    // false if there isn't a big enough hole left
+    bool alloc(uint32_t size, uint32_t *offset);
+    void free(uint32_t offset, uint32_t size);
+    uint32_t used() const { return inUse; }
+
+  private:
+    std::map<uint32_t, uint32_t> holes;  // offset -> size
+    uint32_t inUse = 0;
+};
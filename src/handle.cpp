@@ -4,8 +4,28 @@
 #include <filesystem>
 #include <fstream>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// how far ahead of the read position we ask the OS to page in
+static const int64_t ReadAheadWindow = 4 * 1024 * 1024;
+
 Handle::Handle(const std::string &filename) {
   data = pos = nullptr;
+  // map the file when we can, so large worlds are read straight from the page cache
+  if (map(filename)) {
+    pos = data;
+    advise(pos);
+    return;
+  }
   std::ifstream f(filename, std::ios::in | std::ios::binary);
   if (!f.is_open()) {
     return;
@@ -23,36 +43,126 @@ Handle::Handle(uint8_t *data, uint32_t len) : data(data), length(len) {
   alloc = false;
 }
 
+Handle::Handle(const Handle &parent, int64_t start, int64_t end) : length(end), data(parent.data) {
+  // offsets stay relative to the start of the file, so errors point at the right spot
+  pos = data + start;
+  alloc = false;
+  sectionName = parent.sectionName;
+  if (start < 0 || start > end || end > parent.length) {
+    fail("view of " + std::to_string(start) + "-" + std::to_string(end) + " past the end");
+  }
+}
+
 Handle::~Handle() {
+  if (mapped) {
+    unmap();
+  }
   if (alloc) {
     delete [] data;
   }
 }
 
-bool Handle::isOpen() const {
-  return data != nullptr;
+#ifdef _WIN32
+bool Handle::map(const std::string &filename) {
+  file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    file = nullptr;
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    file = nullptr;
+    return false;
+  }
+  // copy-on-write so callers may scribble on the buffer like they could before
+  mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    CloseHandle(file);
+    file = nullptr;
+    return false;
+  }
+  data = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+  if (data == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    mapping = file = nullptr;
+    return false;
+  }
+  length = size.QuadPart;
+  mapped = true;
+  return true;
 }
 
-int64_t Handle::tell() const {
-  return pos - data;
+void Handle::unmap() {
+  UnmapViewOfFile(data);
+  CloseHandle(mapping);
+  CloseHandle(file);
+  mapping = file = nullptr;
+  mapped = false;
 }
 
-uint8_t Handle::r8() {
-  return *pos++;
+void Handle::advise(uint8_t *from) {
+  // FILE_FLAG_SEQUENTIAL_SCAN already makes the cache manager read ahead
+  window = from + ReadAheadWindow;
+}
+#else
+bool Handle::map(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  // private mapping is copy-on-write so callers may scribble on the buffer like they could before
+  void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);  // the mapping keeps its own reference
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  data = static_cast<uint8_t*>(p);
+  length = st.st_size;
+  mapped = true;
+  madvise(data, length, MADV_SEQUENTIAL);
+  return true;
 }
 
-uint16_t Handle::r16() {
-  uint16_t r = *pos++;
-  r |= *pos++ << 8;
-  return r;
+void Handle::unmap() {
+  munmap(data, length);
+  mapped = false;
 }
 
-uint32_t Handle::r32() {
-  uint32_t r = *pos++;
-  r |= *pos++ << 8;
-  r |= *pos++ << 16;
-  r |= *pos++ << 24;
-  return r;
+void Handle::advise(uint8_t *from) {
+  if (!mapped) {
+    return;
+  }
+  static const uintptr_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+  uint8_t *end = data + length;
+  uint8_t *start = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(from) & ~pageMask);
+  window = from + ReadAheadWindow < end ? from + ReadAheadWindow : end;
+  if (start < window) {
+    madvise(start, window - start, MADV_WILLNEED);
+  }
+}
+#endif
+
+// call periodically from long sequential reads to keep the next window paged in
+void Handle::readAhead() {
+  if (mapped && pos + ReadAheadWindow / 2 > window && window < data + length) {
+    advise(pos);
+  }
+}
+
+bool Handle::isOpen() const {
+  return data != nullptr;
+}
+
+int64_t Handle::tell() const {
+  return pos - data;
 }
 
 uint64_t Handle::r64() {
@@ -80,6 +190,7 @@ double Handle::rd() {
 }
 
 std::string Handle::read(int len) {
+  need(len);
   std::string s(reinterpret_cast<char const *>(pos), len);
   pos += len;
   return s;
@@ -88,7 +199,7 @@ std::string Handle::read(int len) {
 std::string Handle::rcs() {
   std::string r;
   char ch;
-  while ((ch = *pos++) != 0) {
+  while ((ch = r8()) != 0) {
     r += ch;
   }
   return r;
@@ -99,7 +210,10 @@ std::string Handle::rs() {
   int shift = 0;
   uint8_t u7;
   do {
-    u7 = *pos++;
+    u7 = r8();
+    if (shift > 28) {
+      fail("malformed string length");
+    }
     len |= (u7 & 0x7f) << shift;
     shift += 7;
   } while (u7 & 0x80);
@@ -107,15 +221,42 @@ std::string Handle::rs() {
 }
 
 uint8_t *Handle::readBytes(int length) {
+  need(length);
   uint8_t *oldpos = pos;
   pos += length;
   return oldpos;
 }
 
 void Handle::skip(int64_t length) {
+  need(length);
   pos += length;
 }
 
 void Handle::seek(int64_t p) {
+  if (p < 0 || p > length) {
+    fail("seek to " + std::to_string(p) + " outside of file");
+  }
   pos = data + p;
+  // compare offsets, window - ReadAheadWindow could point before data
+  if (mapped && (p < (window - data) - ReadAheadWindow || p > window - data)) {
+    advise(pos);  // jumped outside the current window
+  }
+}
+
+// name the region being parsed so overruns can report where they happened
+void Handle::section(const std::string &name, int64_t start, int64_t end) {
+  sectionName = name;
+  sectionEnd = end;
+  seek(start);
+}
+
+// checked once per section instead of per read
+void Handle::endSection() {
+  if (sectionEnd >= 0 && tell() > sectionEnd) {
+    fail("overran section by " + std::to_string(tell() - sectionEnd) + " bytes");
+  }
+}
+
+void Handle::fail(const std::string &what) const {
+  throw HandleError(sectionName, tell(), what);
 }
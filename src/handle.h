@@ -5,19 +5,53 @@
 #include <string>
 #include <cstdint>
 
+class HandleError {
+  public:
+    HandleError(const std::string &section, int64_t offset, const std::string &what) :
+      reason(what + " in " + section + " at offset " + std::to_string(offset)) {}
+    std::string reason;
+};
+
 class Handle {
   public:
     explicit Handle(const std::string &filename);
     Handle(uint8_t *data, uint32_t len);
+    // a view of [start, end) of another handle's buffer, for reading it from another thread
+    Handle(const Handle &parent, int64_t start, int64_t end);
     ~Handle();
 
     bool isOpen() const;
     bool eof() const;
     int64_t tell() const;
-    
-    uint8_t r8();
-    uint16_t r16();
-    uint32_t r32();
+    int64_t remaining() const {
+      return length - (pos - data);
+    }
+
+    // Every read is bounds checked and throws HandleError on overrun.
+    // Hot loops can check remaining() once for a whole record and then
+    // use the unchecked <false> variants.
+    template <bool Checked = true> uint8_t r8() {
+      if constexpr (Checked) {
+        need(1);
+      }
+      return *pos++;
+    }
+    template <bool Checked = true> uint16_t r16() {
+      if constexpr (Checked) {
+        need(2);
+      }
+      uint16_t r = pos[0] | (pos[1] << 8);
+      pos += 2;
+      return r;
+    }
+    template <bool Checked = true> uint32_t r32() {
+      if constexpr (Checked) {
+        need(4);
+      }
+      uint32_t r = pos[0] | (pos[1] << 8) | (pos[2] << 16) | (static_cast<uint32_t>(pos[3]) << 24);
+      pos += 4;
+      return r;
+    }
     uint64_t r64();
     float rf();
     double rd();
@@ -27,10 +61,39 @@ class Handle {
     uint8_t *readBytes(int length);
     void seek(int64_t pos);
     void skip(int64_t length);
+    void readAhead();
+    // raw access for decoders that do their own bounds checking
+    const uint8_t *cursor() const {
+      return pos;
+    }
+    void advance(const uint8_t *to) {
+      need(to - pos);
+      pos += to - pos;
+    }
+
+    void need(int64_t len) {
+      if (len < 0 || len > remaining()) {
+        fail("read of " + std::to_string(len) + " bytes past the end");
+      }
+    }
+    void section(const std::string &name, int64_t start, int64_t end);
+    void endSection();
+    void fail(const std::string &what) const;
 
-    int64_t length;
+    int64_t length = 0;
 
   private:
+    bool map(const std::string &filename);
+    void unmap();
+    void advise(uint8_t *from);
+
     uint8_t *data, *pos;
+    uint8_t *window = nullptr;  // end of the last read-ahead request
     bool alloc = false;
+    bool mapped = false;
+    std::string sectionName = "file";
+    int64_t sectionEnd = -1;
+#ifdef _WIN32
+    void *file = nullptr, *mapping = nullptr;
+#endif
 };
@@ -46,6 +46,14 @@ void L10n::load(std::string exe) {
   if (!handle.isOpen()) {
     return;
   }
+  try {
+    parse(handle);
+  } catch (HandleError &e) {
+    SDL_Log("Failed to read translations: %s", e.reason.c_str());
+  }
+}
+
+void L10n::parse(Handle &handle) {
   if (handle.r16() != 0x5a4d) {  // not an MZ exe
     return;
   }
@@ -22,6 +22,7 @@ class L10n {
     std::string selectedLanguage() const;
 
   private:
+    void parse(class Handle &handle);
     std::unordered_map<std::string, std::shared_ptr<JSONData>> items;
     std::unordered_map<std::string, std::shared_ptr<JSONData>> prefixes;
     std::unordered_map<std::string, std::shared_ptr<JSONData>> npcs;
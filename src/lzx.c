@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #ifdef __GNUC__
 #define memcpy __builtin_memcpy
@@ -43,6 +44,7 @@ typedef unsigned char  UBYTE; /* 8 bits exactly    */
 typedef unsigned short UWORD; /* 16 bits (or more) */
 typedef unsigned int   ULONG; /* 32 bits (or more) */
 typedef   signed int    LONG; /* 32 bits (or more) */
+typedef uint64_t       BITBUF; /* 64 bits exactly    */
 
 /* some constants defined by the LZX specification */
 #define LZX_MIN_MATCH                (2)
@@ -252,27 +254,41 @@ int LZXreset(struct LZXstate *pState)
  *
  * These bit access routines work by using the area beyond the MSB and the
  * LSB as a free source of zeroes. This avoids having to mask any bits.
- * So we have to know the bit width of the bitbuffer variable. This is
- * sizeof(ULONG) * 8, also defined as ULONG_BITS
- */
-
-/* number of bits in ULONG. Note: This must be at multiple of 16, and at
- * least 32 for the bitbuffer code to work (ie, it must be able to ensure
- * up to 17 bits - that's adding 16 bits when there's one bit left, or
- * adding 32 bits when there are no bits left. The code should work fine
- * for machines where ULONG >= 32 bits.
+ * So we have to know the bit width of the bitbuffer variable, BITBUF_BITS.
+ *
+ * The bitbuffer is 64 bits wide so that one refill is good for several
+ * symbols. While there are at least 8 bytes of input left, ENSURE_BITS()
+ * tops the buffer up with as many whole 16-bit words as fit in one go,
+ * otherwise it falls back to fetching a word at a time. Either way, inpos
+ * can run ahead of the bits actually used by up to (bitsleft / 16) words.
  */
-#define ULONG_BITS (sizeof(ULONG)<<3)
+#define BITBUF_BITS (64)
 
 #define INIT_BITSTREAM do { bitsleft = 0; bitbuf = 0; } while (0)
 
+/* the 16-bit little endian word at p */
+#define WORD_AT(p) ((BITBUF) (((p)[1]<<8)|(p)[0]))
+
 #define ENSURE_BITS(n)							\
-  while (bitsleft < (n)) {						\
-    bitbuf |= ((inpos[1]<<8)|inpos[0]) << (ULONG_BITS-16 - bitsleft);	\
-    bitsleft += 16; inpos+=2;						\
+  if (bitsleft < (n)) {							\
+    if (endinp - inpos >= 8) {						\
+      int words_ = (BITBUF_BITS - bitsleft) >> 4;			\
+      BITBUF next_ = (WORD_AT(inpos) << 48) | (WORD_AT(inpos+2) << 32) |	\
+                     (WORD_AT(inpos+4) << 16) | WORD_AT(inpos+6);	\
+      next_ >>= 64 - (words_ << 4);					\
+      bitbuf |= next_ << (BITBUF_BITS - (words_ << 4) - bitsleft);	\
+      bitsleft += words_ << 4; inpos += words_ << 1;			\
+    }									\
+    else while (bitsleft < (n)) {					\
+      bitbuf |= WORD_AT(inpos) << (BITBUF_BITS-16 - bitsleft);		\
+      bitsleft += 16; inpos+=2;						\
+    }									\
   }
 
-#define PEEK_BITS(n)   (bitbuf >> (ULONG_BITS - (n)))
+/* whole words fetched into the bitbuffer but not used yet */
+#define UNUSED_BYTES ((bitsleft >> 4) << 1)
+
+#define PEEK_BITS(n)   (bitbuf >> (BITBUF_BITS - (n)))
 #define REMOVE_BITS(n) ((bitbuf <<= (n)), (bitsleft -= (n)))
 
 #define READ_BITS(v,n) do {						\
@@ -307,10 +323,10 @@ int LZXreset(struct LZXstate *pState)
   ENSURE_BITS(16);							\
   hufftbl = SYMTABLE(tbl);						\
   if ((i = hufftbl[PEEK_BITS(TABLEBITS(tbl))]) >= MAXSYMBOLS(tbl)) {	\
-    j = 1 << (ULONG_BITS - TABLEBITS(tbl));				\
+    j = BITBUF_BITS - TABLEBITS(tbl); /* next bit down */		\
     do {								\
-      j >>= 1; i <<= 1; i |= (bitbuf & j) ? 1 : 0;			\
-      if (!j) { return DECR_ILLEGALDATA; }	                        \
+      if (!j--) { return DECR_ILLEGALDATA; }				\
+      i <<= 1; i |= (bitbuf >> j) & 1;					\
     } while ((i = hufftbl[i]) >= MAXSYMBOLS(tbl));			\
   }									\
   j = LENTABLE(tbl)[(var) = i];						\
@@ -318,12 +334,26 @@ int LZXreset(struct LZXstate *pState)
 } while (0)
 
 
+/* COPY_MATCH(dest, src, len) copies a match within the window. Once the
+ * source is at least 8 bytes back, 8 byte chunks never read anything they
+ * haven't written yet, so only short offsets need to go a byte at a time.
+ */
+#define COPY_MATCH(dest,src,len) do {					\
+  if ((dest) - (src) >= 8) {						\
+    while ((len) >= 8) {						\
+      memcpy((dest), (src), 8); (dest) += 8; (src) += 8; (len) -= 8;	\
+    }									\
+  }									\
+  while ((len)-- > 0) *(dest)++ = *(src)++;				\
+} while (0)
+
+
 /* READ_LENGTHS(tablename, first, last) reads in code lengths for symbols
  * first to last in the given table. The code lengths are stored in their
  * own special LZX way.
  */
 #define READ_LENGTHS(tbl,first,last) do { \
-  lb.bb = bitbuf; lb.bl = bitsleft; lb.ip = inpos; \
+  lb.bb = bitbuf; lb.bl = bitsleft; lb.ip = inpos; lb.ie = endinp; \
   if (lzx_read_lens(pState, LENTABLE(tbl),(first),(last),&lb)) { \
     return DECR_ILLEGALDATA; \
   } \
@@ -346,30 +376,39 @@ int LZXreset(struct LZXstate *pState)
  */
 
 static int make_decode_table(ULONG nsyms, ULONG nbits, UBYTE *length, UWORD *table) {
-    register UWORD sym;
+    UWORD sorted[LZX_MAINTREE_MAXSYMBOLS]; /* symbols in canonical code order */
+    ULONG count[17], next[17];
+    register ULONG sym;
     register ULONG leaf;
-    register UBYTE bit_num = 1;
-    ULONG fill;
+    register UBYTE bit_num;
+    ULONG fill, k, used;
     ULONG pos         = 0; /* the current position in the decode table */
     ULONG table_mask  = 1 << nbits;
-    ULONG bit_mask    = table_mask >> 1; /* don't do 0 length codes */
-    ULONG next_symbol = bit_mask; /* base of allocation for long codes */
+    ULONG bit_mask;
+    ULONG next_symbol = table_mask >> 1; /* base of allocation for long codes */
+
+    /* sort the symbols by code length once, rather than scanning all of
+     * them for every length */
+    for (k = 0; k <= 16; k++) count[k] = 0;
+    for (sym = 0; sym < nsyms; sym++) count[length[sym]]++;
+    next[1] = 0;
+    for (k = 1; k < 16; k++) next[k + 1] = next[k] + count[k];
+    used = next[16] + count[16];
+    for (sym = 0; sym < nsyms; sym++) {
+        if (length[sym]) sorted[next[length[sym]]++] = sym;
+    }
 
     /* fill entries for codes short enough for a direct mapping */
-    while (bit_num <= nbits) {
-        for (sym = 0; sym < nsyms; sym++) {
-            if (length[sym] == bit_num) {
-                leaf = pos;
+    for (k = 0; k < used && (bit_num = length[sorted[k]]) <= nbits; k++) {
+        sym = sorted[k];
+        bit_mask = table_mask >> bit_num;
+        leaf = pos;
 
-                if((pos += bit_mask) > table_mask) return 1; /* table overrun */
+        if((pos += bit_mask) > table_mask) return 1; /* table overrun */
 
-                /* fill all possible lookups of this symbol with the symbol itself */
-                fill = bit_mask;
-                while (fill-- > 0) table[leaf++] = sym;
-            }
-        }
-        bit_mask >>= 1;
-        bit_num++;
+        /* fill all possible lookups of this symbol with the symbol itself */
+        fill = bit_mask;
+        while (fill-- > 0) table[leaf++] = sym;
     }
 
     /* if there are any codes longer than nbits */
@@ -380,30 +419,26 @@ static int make_decode_table(ULONG nsyms, ULONG nbits, UBYTE *length, UWORD *tab
         /* give ourselves room for codes to grow by up to 16 more bits */
         pos <<= 16;
         table_mask <<= 16;
-        bit_mask = 1 << 15;
-
-        while (bit_num <= 16) {
-            for (sym = 0; sym < nsyms; sym++) {
-                if (length[sym] == bit_num) {
-                    leaf = pos >> 16;
-                    for (fill = 0; fill < bit_num - nbits; fill++) {
-                        /* if this path hasn't been taken yet, 'allocate' two entries */
-                        if (table[leaf] == 0) {
-                            table[(next_symbol << 1)] = 0;
-                            table[(next_symbol << 1) + 1] = 0;
-                            table[leaf] = next_symbol++;
-                        }
-                        /* follow the path and select either left or right for next bit */
-                        leaf = table[leaf] << 1;
-                        if ((pos >> (15-fill)) & 1) leaf++;
-                    }
-                    table[leaf] = sym;
 
-                    if ((pos += bit_mask) > table_mask) return 1; /* table overflow */
+        for (; k < used; k++) {
+            sym = sorted[k];
+            bit_num = length[sym];
+            bit_mask = 1 << (16 + nbits - bit_num);
+            leaf = pos >> 16;
+            for (fill = 0; fill < bit_num - nbits; fill++) {
+                /* if this path hasn't been taken yet, 'allocate' two entries */
+                if (table[leaf] == 0) {
+                    table[(next_symbol << 1)] = 0;
+                    table[(next_symbol << 1) + 1] = 0;
+                    table[leaf] = next_symbol++;
                 }
+                /* follow the path and select either left or right for next bit */
+                leaf = table[leaf] << 1;
+                if ((pos >> (15-fill)) & 1) leaf++;
             }
-            bit_mask >>= 1;
-            bit_num++;
+            table[leaf] = sym;
+
+            if ((pos += bit_mask) > table_mask) return 1; /* table overflow */
         }
     }
 
@@ -411,23 +446,24 @@ static int make_decode_table(ULONG nsyms, ULONG nbits, UBYTE *length, UWORD *tab
     if (pos == table_mask) return 0;
 
     /* either erroneous table, or all elements are 0 - let's find out. */
-    for (sym = 0; sym < nsyms; sym++) if (length[sym]) return 1;
-    return 0;
+    return used != 0;
 }
 
 struct lzx_bits {
-  ULONG bb;
+  BITBUF bb;
   int bl;
   UBYTE *ip;
+  UBYTE *ie;
 };
 
 static int lzx_read_lens(struct LZXstate *pState, UBYTE *lens, ULONG first, ULONG last, struct lzx_bits *lb) {
     ULONG i,j, x,y;
     int z;
 
-    register ULONG bitbuf = lb->bb;
+    register BITBUF bitbuf = lb->bb;
     register int bitsleft = lb->bl;
     UBYTE *inpos = lb->ip;
+    UBYTE *endinp = lb->ie;
     UWORD *hufftbl;
 
     for (x = 0; x < 20; x++) {
@@ -476,7 +512,7 @@ int LZXdecompress(struct LZXstate *pState, unsigned char *inpos, unsigned char *
     ULONG R1 = pState->R1;
     ULONG R2 = pState->R2;
 
-    register ULONG bitbuf;
+    register BITBUF bitbuf;
     register int bitsleft;
     ULONG match_offset, i,j,k; /* ijk used in READ_HUFFSYM macro */
     struct lzx_bits lb; /* used in READ_LENGTHS macro */
@@ -527,7 +563,7 @@ int LZXdecompress(struct LZXstate *pState, unsigned char *inpos, unsigned char *
                 case LZX_BLOCKTYPE_UNCOMPRESSED:
                     pState->intel_started = 1; /* because we can't assume otherwise */
                     ENSURE_BITS(16); /* get up to 16 pad bits into the buffer */
-                    if (bitsleft > 16) inpos -= 2; /* and align the bitstream! */
+                    inpos -= ((bitsleft - 1) >> 4) << 1; /* and align the bitstream! */
                     R0 = inpos[0]|(inpos[1]<<8)|(inpos[2]<<16)|(inpos[3]<<24);inpos+=4;
                     R1 = inpos[0]|(inpos[1]<<8)|(inpos[2]<<16)|(inpos[3]<<24);inpos+=4;
                     R2 = inpos[0]|(inpos[1]<<8)|(inpos[2]<<16)|(inpos[3]<<24);inpos+=4;
@@ -544,11 +580,11 @@ int LZXdecompress(struct LZXstate *pState, unsigned char *inpos, unsigned char *
              * 16 bits in size. In this case, the READ_HUFFSYM() macro used
              * in building the tables will exhaust the buffer, so we should
              * allow for this, but not allow those accidentally read bits to
-             * be used (so we check that there are at least 16 bits
-             * remaining - in this boundary case they aren't really part of
-             * the compressed data)
+             * be used (so we check that the overrun is still sitting unused
+             * in the bitbuffer - in this boundary case they aren't really
+             * part of the compressed data)
              */
-            if (inpos > (endinp+2) || bitsleft < 16) return DECR_ILLEGALDATA;
+            if (inpos - UNUSED_BYTES > endinp) return DECR_ILLEGALDATA;
         }
 
         while ((this_run = pState->block_remaining) > 0 && togo > 0) {
@@ -623,7 +659,7 @@ int LZXdecompress(struct LZXstate *pState, unsigned char *inpos, unsigned char *
                                 *rundest++ = *(runsrc + window_size); runsrc++;
                             }
                             /* copy match data - no worries about destination wraps */
-                            while (match_length-- > 0) *rundest++ = *runsrc++;
+                            COPY_MATCH(rundest, runsrc, match_length);
 
                         }
                     }
@@ -704,7 +740,7 @@ int LZXdecompress(struct LZXstate *pState, unsigned char *inpos, unsigned char *
                                 *rundest++ = *(runsrc + window_size); runsrc++;
                             }
                             /* copy match data - no worries about destination wraps */
-                            while (match_length-- > 0) *rundest++ = *runsrc++;
+                            COPY_MATCH(rundest, runsrc, match_length);
 
                         }
                     }
@@ -15,6 +15,7 @@
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/matrix.hpp>
+#include <algorithm>
 
 const float MaxZoom = 2.2f;
 const float MinZoom = 0.01f;
@@ -29,27 +30,37 @@ const float LiquidLayer = 4.f;
 const float WireLayer = 5.f;
 const float HouseLayer = 6.f;
 
+const int RenderChunk = 64;  // tiles on a side
+
 Map::Map(World &world) : world(world) {}
 
 std::string Map::init(SDL_GPUDevice *gpu) {
   return renderer.init(gpu);
 }
 
+// runs on the loader thread, copy() picks up the tiles as they land
 bool Map::load(std::string filename, SDL_Mutex *mutex) {
   if (!world.load(filename, mutex)) {
     world.failed = true;
     return false;
   }
-  jumpToSpawn();
-  calcBounds();
   return true;
 }
 
+void Map::reset() {
+  world.reset();
+  renderer.resetChunks();
+  bands = 0;
+  colored = 0;
+  prefetched = false;
+}
+
 std::string Map::progress() {
   return world.progress();
 }
 
 bool Map::setTextures(const std::filesystem::path &path) {
+  renderer.resetChunks();
   return renderer.setTextures(path);
 }
 
@@ -75,7 +86,7 @@ std::string Map::getStatus(const L10n &l10n, float x, float y) {
     return "";
   }
   auto pos = mouseToTile(x, y);
-  const auto &tile = world.tiles[pos.y * world.tilesWide + pos.x];
+  Tile tile = world.tiles[pos.y * world.tilesWide + pos.x];
   std::string r = std::to_string(pos.x) + "," + std::to_string(pos.y);
   if (tile.active()) {
     auto info = world.info[tile];
@@ -84,6 +95,8 @@ std::string Map::getStatus(const L10n &l10n, float x, float y) {
     auto info = world.info.walls[tile.wall];
     r += " : " + l10n.xlateItem(info->name);
   }
+  // how many binds the last frame took, to keep an eye on draw batching
+  r += " (" + std::to_string(renderer.changes()) + " binds)";
   return r;
 }
 
@@ -139,11 +152,16 @@ void Map::npcMenu(const L10n &l10n) {
 
 void Map::showTextures(bool textures) {
   this->textures = textures;
+  // copy() only prefetches when the world finishes loading
+  if (textures && world.loaded && !prefetched) {
+    prefetch();
+  }
   dirty = true;
 }
 
 void Map::showWires(bool wires) {
   this->wires = wires;
+  renderer.resetChunks();
   dirty = true;
 }
 
@@ -161,9 +179,29 @@ bool Map::failed() {
 }
 
 void Map::copy(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
-  if (!world.loaded) {
+  int landed = world.bands();
+  if (landed == 0) {
     return;
   }
+  if (landed != bands) {
+    if (bands == 0) {
+      jumpToSpawn();  // the first band is around spawn
+    }
+    bands = landed;
+    renderer.resetChunks();  // chunks on the edge only drew part of their tiles
+    calcBounds();
+    if (world.loaded && textures && !prefetched) {
+      prefetch();
+    }
+  }
+  if (world.coloredBands() != colored) {
+    colored = world.coloredBands();
+    renderer.resetFlat();
+    dirty = true;
+  }
+  if (renderer.updateTextures(copy)) {
+    dirty = true;
+  }
   if (!dirty) {
     return;
   }
@@ -172,14 +210,11 @@ void Map::copy(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
   renderer.clear();
 
   if (textures && zoom >= 0.3f) {
-    if (wires) {
-      drawWires(gpu, copy);
+    if (world.loaded) {
+      drawNPCs(gpu, copy);
     }
-    drawNPCs(gpu, copy);
-    drawTiles(gpu, copy);
-    drawWalls(gpu, copy);
+    drawChunks(gpu, copy);
     drawBackground(gpu, copy);
-    drawLiquids(gpu, copy);
   } else {
     drawFlat(gpu, copy);
   }
@@ -187,6 +222,82 @@ void Map::copy(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
   renderer.copy(copy);
 }
 
+// Queue up the textures this world is going to want.  What's around spawn
+// goes first, since that's where we start, then the rest by how common it is.
+void Map::prefetch() {
+  prefetched = true;
+  struct Want {
+    bool near;
+    uint32_t count;
+    int slot;
+  };
+  std::vector<Want> wants;
+  for (size_t type = 0; type < world.tileUsage.size(); type++) {
+    const auto &usage = world.tileUsage[type];
+    if (usage.total > 0) {
+      wants.push_back({usage.near > 0, usage.near > 0 ? usage.near : usage.total, Textures::Tile | static_cast<int>(type)});
+    }
+  }
+  for (size_t type = 0; type < world.wallUsage.size(); type++) {
+    const auto &usage = world.wallUsage[type];
+    if (usage.total > 0) {
+      wants.push_back({usage.near > 0, usage.near > 0 ? usage.near : usage.total, Textures::Wall | static_cast<int>(type)});
+    }
+  }
+  // town npcs hang around spawn, and there aren't many of them.  near is
+  // the same box countUsage uses, npcs are in pixels.
+  float spawnX = world.header["spawnX"]->toDouble(), spawnY = world.header["spawnY"]->toDouble();
+  for (const auto &npc : world.npcs) {
+    bool near = fabs(npc.x / 16 - spawnX) < World::NearWide / 2 && fabs(npc.y / 16 - spawnY) < World::NearHigh / 2;
+    if (npc.sprite != 0) {
+      wants.push_back({near, UINT32_MAX, Textures::NPC | npc.sprite});
+    }
+    if (npc.head != 0) {
+      wants.push_back({false, 0, Textures::NPCHead | npc.head});
+    }
+  }
+  std::sort(wants.begin(), wants.end(), [](const Want &a, const Want &b) {
+    if (a.near != b.near) {
+      return a.near;
+    }
+    if (a.count != b.count) {
+      return a.count > b.count;
+    }
+    return a.slot < b.slot;
+  });
+  std::vector<int> slots;
+  for (const auto &want : wants) {
+    slots.push_back(want.slot);
+  }
+  renderer.prefetch(slots);
+}
+
+// Tiles, walls, liquids and wires are built a chunk at a time, and the
+// renderer keeps the chunks it has built, so a pan only builds the chunks
+// that scroll into view.
+void Map::drawChunks(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
+  int left, right;
+  drawableColumns(&left, &right);
+  int chunksWide = (world.tilesWide + RenderChunk - 1) / RenderChunk;
+  for (int cy = startY / RenderChunk; cy * RenderChunk < endY; cy++) {
+    for (int cx = startX / RenderChunk; cx * RenderChunk < endX; cx++) {
+      if (!renderer.beginChunk(cy * chunksWide + cx)) {
+        int fromX = std::max(cx * RenderChunk, left);
+        int toX = std::min((cx + 1) * RenderChunk, right);
+        int fromY = cy * RenderChunk;
+        int toY = std::min(fromY + RenderChunk, world.tilesHigh);
+        if (wires) {
+          drawWires(gpu, copy, fromX, fromY, toX, toY);
+        }
+        drawTiles(gpu, copy, fromX, fromY, toX, toY);
+        drawWalls(gpu, copy, fromX, fromY, toX, toY);
+        drawLiquids(gpu, copy, fromX, fromY, toX, toY);
+      }
+      renderer.endChunk();
+    }
+  }
+}
+
 static int trackUVs[] = {
   0, 0, 0,  1, 0, 0,  2, 1, 1,  3, 1, 1,  0, 2, 8,  1, 2, 4,  0, 1, 0,  1, 1, 0,
   0, 3, 4,  1, 3, 8,  4, 1, 9,  5, 1, 5,  6, 1, 1,  7, 1, 1,  2, 0, 0,  3, 0, 0,
@@ -195,16 +306,17 @@ static int trackUVs[] = {
   4, 3, 4,  5, 3, 8,  6, 3, 4,  7, 3, 8,  0, 6, 0,  1, 6, 0,  1, 7, 0,  0, 7, 0,
 };
 
-void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
+void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY) {
+  const auto &tiles = world.tiles;
   int stride = world.tilesWide;
-  for (int y = startY; y < endY; y++) {
-    int offset = y * stride + startX;
-    for (int x = startX; x < endX; x++, offset++) {
-      auto &tile = world.tiles[offset];
+  for (int y = fromY; y < toY; y++) {
+    int offset = y * stride + fromX;
+    for (int x = fromX; x < toX; x++, offset++) {
+      Tile tile = tiles[offset];
       auto info = world.info[tile];
       if (tile.active()) {
-        if (tile.u < 0) {
-          UVRules::mapTile(world, x, y);
+        if (tile.u < 0) {  // not resolved while loading, work it out without touching the world
+          UVRules::tileUV(world, x, y, tile.u, tile.v);
         }
         bool fliph = info->flip && (x & 1);
         bool flipv = false;
@@ -340,7 +452,7 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
             palmu = 2;
           }
           int poff = offset;
-          while (world.tiles[poff].active() && world.tiles[poff].type == TilePalm) {
+          while (tiles.active(poff) && tiles.type(poff) == TilePalm) {
             poff += stride;
           }
           int variant = getPalmVariant(poff);
@@ -398,7 +510,7 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
                     break;
                 }
               }
-              while (world.tiles[toff].active() && world.tiles[toff].type == tile.type) {
+              while (tiles.active(toff) && tiles.type(toff) == tile.type) {
                 toff += stride;
               }
               u += 176 * getTreeVariant(toff);
@@ -451,10 +563,10 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
                   break;
               }
               int end = offset + 20 * stride;
-              while (!world.tiles[coff].active() && world.tiles[coff].type == TileCactus && coff < end) {
+              while (!tiles.active(coff) && tiles.type(coff) == TileCactus && coff < end) {
                      coff += stride;
               }
-              switch (world.tiles[coff].type) {
+              switch (tiles.type(coff)) {
                 case TileEbonSand:
                   v += 54;
                   break;
@@ -470,7 +582,7 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
           case TilePalm:
              {
                int poff = offset;
-               while (world.tiles[poff].active() && world.tiles[poff].type == TilePalm) {
+               while (tiles.active(poff) && tiles.type(poff) == TilePalm) {
                  poff += stride;
                }
                v = 22 * getPalmVariant(poff);
@@ -502,11 +614,11 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
           case TileFaeling:    
             {
               int toff = offset;
-              while (toff > 0 && world.tiles[toff].type == tile.type) {
+              while (toff > 0 && tiles.type(toff) == tile.type) {
                 toff -= stride;
               }
               // banner under a platform?
-              if (world.tiles[toff].type == TilePlatforms && !world.tiles[toff].half()) {
+              if (tiles.type(toff) == TilePlatforms && !tiles.half(toff)) {
                 topPad -= 8;
               }
             }
@@ -553,17 +665,17 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
         } else if (tile.slope > 0) {
           if (tile.type == TilePlatforms) {
             renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad, TileLayer, texw, texh, u, v, paint);
-            const auto &br = world.tiles[offset + stride + 1];
-            const auto &bl = world.tiles[offset + stride - 1];
-            if (tile.slope == 1 && br.active() && br.slope != 2 && !br.half()) {
+            int br = offset + stride + 1;
+            int bl = offset + stride - 1;
+            if (tile.slope == 1 && tiles.active(br) && tiles.slope(br) != 2 && !tiles.half(br)) {
               u = 198;
-              if (br.type == TilePlatforms && br.slope == 0) {
+              if (tiles.type(br) == TilePlatforms && tiles.slope(br) == 0) {
                 u = 324;
               }
               renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad + 16, TileLayer, 16, 16, u, v, paint);
-            } else if (tile.slope == 2 && bl.active() && bl.slope != 1 && !bl.half()) {
+            } else if (tile.slope == 2 && tiles.active(bl) && tiles.slope(bl) != 1 && !tiles.half(bl)) {
               u = 162;
-              if (bl.type == TilePlatforms && bl.slope == 0) {
+              if (tiles.type(bl) == TilePlatforms && tiles.slope(bl) == 0) {
                 u = 306;
               }
               renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad + 16, TileLayer, 16, 16, u, v, paint);
@@ -574,18 +686,18 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
             renderer.addSlope(copy, Textures::Tile | tile.type, tile.slope, leftPad, topPad, TileLayer, texw, texh, u, v, paint);
           }
         }  else if (tile.type != TilePlatforms && tile.type != TilePlanters && info->solid && !tile.half() &&
-                    ((x > 0 && world.tiles[offset - 1].half()) ||
-                  ((x < world.tilesWide - 1 && world.tiles[offset + 1].half())))) {
+                    ((x > 0 && tiles.half(offset - 1)) ||
+                  ((x < world.tilesWide - 1 && tiles.half(offset + 1))))) {
           // adjacent to half block
-          if (world.tiles[offset - 1].half() && world.tiles[offset + 1].half()) {
+          if (tiles.half(offset - 1) && tiles.half(offset + 1)) {
             // both sides are half
             renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad + 8, TileLayer, texw, 8, u, v + 8, paint);
-            if (world.tiles[offset - stride].slope < 3 && world.tiles[offset - stride].type == tile.type) {
+            if (tiles.slope(offset - stride) < 3 && tiles.type(offset - stride) == tile.type) {
               renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad, TileLayer, 16, 8, 90, 0, paint);
             } else {
               renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad, TileLayer, 16, 8, 126, 0, paint);
             }
-          } else if (world.tiles[offset - 1].half()) {
+          } else if (tiles.half(offset - 1)) {
             // just left side
             renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad + 8, TileLayer, texw, 8, u, v + 8, paint);
             renderer.addTile(copy, Textures::Tile | tile.type, leftPad + 4, topPad, TileLayer, texw - 4, texh, u + 4, v, paint);
@@ -597,9 +709,9 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
             renderer.addTile(copy, Textures::Tile | tile.type, leftPad + 12, topPad, TileLayer, 4, 8, 144, 0, paint);
           }
         } else if (tile.half() && y < world.tilesHigh - 1 &&
-                   (!world.tiles[offset + stride].active() ||
-                   !world.info[world.tiles[offset + stride].type]->solid ||
-                   world.tiles[offset + stride].half())) {
+                   (!tiles.active(offset + stride) ||
+                   !world.info[tiles.type(offset + stride)]->solid ||
+                   tiles.half(offset + stride))) {
           // half block over nothing
           if (tile.type == TilePlatforms) {
             renderer.addTile(copy, Textures::Tile | tile.type, leftPad, topPad, TileLayer, texw, texh, u, v, paint);
@@ -615,46 +727,47 @@ void Map::drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
   }
 }
 
-void Map::drawWalls(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
+void Map::drawWalls(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY) {
+  const auto &tiles = world.tiles;
   int stride = world.tilesWide;
-  for (int y = startY; y < endY; y++) {
-    int offset = y * stride + startX;
-    for (int x = startX; x < endX; x++, offset++) {
-      const auto &tile = world.tiles[offset];
-      if (tile.wall > 0) {
-        if (tile.wallu < 0) {
-          UVRules::mapWall(world, x, y);
+  for (int y = fromY; y < toY; y++) {
+    int offset = y * stride + fromX;
+    for (int x = fromX; x < toX; x++, offset++) {
+      if (tiles.wall(offset) > 0) {
+        int16_t wallu = tiles.wallu(offset), wallv = tiles.wallv(offset);
+        if (wallu < 0) {
+          UVRules::wallUV(world, x, y, wallu, wallv);
         }
 
-        int paint = tile.wallPaint;
+        int paint = tiles.wallPaint(offset);
         if (paint == 30) {
           paint = 43;
         } else if (paint >= 28) {
           paint = 40 + paint - 28;
         }
 
-        renderer.addTile(copy, Textures::Wall | tile.wall, x * 16 - 8, y * 16 - 8, WallLayer, 32, 32, tile.wallu, tile.wallv, paint, false);
-        int blend = world.info.walls[tile.wall]->blend;
+        renderer.addTile(copy, Textures::Wall | tiles.wall(offset), x * 16 - 8, y * 16 - 8, WallLayer, 32, 32, wallu, wallv, paint, false);
+        int blend = world.info.walls[tiles.wall(offset)]->blend;
         if (x > 0) {
-          int wall = world.tiles[offset - 1].wall;
+          int wall = tiles.wall(offset - 1);
           if (wall > 0 && world.info.walls[wall]->blend != blend) {
             renderer.addTile(copy, Textures::Outline, x * 16, y * 16, OutlineLayer, 2, 16, 0, 0, 0, false);
           }
         }
         if (x < world.tilesWide - 2) {
-          int wall = world.tiles[offset + 1].wall;
+          int wall = tiles.wall(offset + 1);
           if (wall > 0 && world.info.walls[wall]->blend != blend) {
             renderer.addTile(copy, Textures::Outline, x * 16 + 14, y * 16, OutlineLayer, 2, 16, 14, 0, 0, false);
           }
         }
         if (y > 0) {
-          int wall = world.tiles[offset - stride].wall;
+          int wall = tiles.wall(offset - stride);
           if (wall > 0 && world.info.walls[wall]->blend != blend) {
             renderer.addTile(copy, Textures::Outline, x * 16, y * 16, OutlineLayer, 16, 2, 0, 0, 0, false);
           }
         }
         if (y < world.tilesHigh - 2) {
-          int wall = world.tiles[offset + stride].wall;
+          int wall = tiles.wall(offset + stride);
           if (wall > 0 && world.info.walls[wall]->blend != blend) {
             renderer.addTile(copy, Textures::Outline, x * 16, y * 16 + 14, OutlineLayer, 16, 2, 0, 14, 0, false);
           }
@@ -704,19 +817,19 @@ void Map::drawBackground(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
   renderer.addHBG(copy, Textures::Underworld | 4, 0, hellBottom, world.tilesWide, world.tilesHigh - hellBottom);
 }
 
-void Map::drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
+void Map::drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY) {
+  const auto &tiles = world.tiles;
   int stride = world.tilesWide;
-  for (int y = startY; y < endY; y++) {
-    int offset = y * stride + startX;
-    for (int x = startX; x < endX; x++, offset++) {
-      const auto &tile = world.tiles[offset];
-      const auto &info = world.info[tile];
+  for (int y = fromY; y < toY; y++) {
+    int offset = y * stride + fromX;
+    for (int x = fromX; x < toX; x++, offset++) {
+      const auto &info = world.info[tiles[offset]];
       // draw liquid behind edge tiles
-      if (tile.active() && info->solid && !tile.inactive() && x > 0 && y > 0 && x < world.tilesWide - 1 && y < world.tilesHigh - 1) {
-        const auto &right = world.tiles[offset + 1];
-        const auto &left = world.tiles[offset - 1];
-        const auto &up = world.tiles[offset - stride];
-        const auto &down = world.tiles[offset + stride];
+      if (tiles.active(offset) && info->solid && !tiles.inactive(offset) && x > 0 && y > 0 && x < world.tilesWide - 1 && y < world.tilesHigh - 1) {
+        int right = offset + 1;
+        int left = offset - 1;
+        int up = offset - stride;
+        int down = offset + stride;
         uint8_t sideLevel = 0;
         int v = 4;
         int waterw = 16;
@@ -726,62 +839,62 @@ void Map::drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
         double alpha = 0.5;
         int variant = 0;
 
-        if (left.liquid > 0 && tile.slope != 1 && tile.slope != 3) {
-          sideLevel = left.liquid;
+        if (tiles.liquid(left) > 0 && tiles.slope(offset) != 1 && tiles.slope(offset) != 3) {
+          sideLevel = tiles.liquid(left);
           mask |= 8;
-          if (left.shimmer()) {
+          if (tiles.shimmer(left)) {
             variant = 14;
             alpha = 0.85;
-          } else if (left.honey()) {
+          } else if (tiles.honey(left)) {
             variant = 11;
             alpha = 0.85;
-          } else if (left.lava()) {
+          } else if (tiles.lava(left)) {
             variant = 1;
             alpha = 0.9;
           }
         }
-        if (right.liquid > 0 && tile.slope != 2 && tile.slope != 4) {
-          if (sideLevel < right.liquid) {
-            sideLevel = right.liquid;
+        if (tiles.liquid(right) > 0 && tiles.slope(offset) != 2 && tiles.slope(offset) != 4) {
+          if (sideLevel < tiles.liquid(right)) {
+            sideLevel = tiles.liquid(right);
           }
           mask |= 4;
-          if (right.shimmer()) {
+          if (tiles.shimmer(right)) {
             variant = 14;
             alpha = 0.85;
-          } else if (right.honey()) {
+          } else if (tiles.honey(right)) {
             variant = 11;
             alpha = 0.85;
-          } else if (right.lava()) {
+          } else if (tiles.lava(right)) {
             variant = 1;
             alpha = 0.9;
           }
         }
-        if (up.liquid > 0 && tile.slope != 3 && tile.slope != 4) {
+        if (tiles.liquid(up) > 0 && tiles.slope(offset) != 3 && tiles.slope(offset) != 4) {
           mask |= 2;
-          if (up.shimmer()) {
+          if (tiles.shimmer(up)) {
             variant = 14;
             alpha = 0.85;
-          } else if (up.honey()) {
+          } else if (tiles.honey(up)) {
             variant = 11;
             alpha = 0.85;
-          } else if (up.lava()) {
+          } else if (tiles.lava(up)) {
             variant = 1;
             alpha = 0.9;
           }
-        } else if (!up.active() || !world.info[up.type]->solid || tile.slope == 3 || tile.slope == 4) {
+        } else if (!tiles.active(up) || !world.info[tiles.type(up)]->solid || tiles.slope(offset) == 3 || tiles.slope(offset) == 4) {
           v = 0;  // water has a ripple
         }
-        if (down.liquid > 0 && tile.slope != 1 && tile.slope != 2) {
-          if (down.liquid > 240) {
+        if (tiles.liquid(down) > 0 && tiles.slope(offset) != 1 && tiles.slope(offset) != 2) {
+          if (tiles.liquid(down) > 240) {
             mask |= 1;
           }
-          if (down.shimmer()) {
+          if (tiles.shimmer(down)) {
             variant = 14;
             alpha = 0.85;
-          } else if (down.honey()) {
+          } else if (tiles.honey(down)) {
             variant = 11;
             alpha = 0.85;
-          } else if (down.lava()) {
+          } else if (tiles.lava(down)) {
             variant = 1;
             alpha = 0.9;
           }
@@ -790,7 +903,7 @@ void Map::drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
           if ((mask & 0xc) && (mask & 1)) {  // down + any side is the same as both sides
             mask |= 0xc;
           }
-          if (tile.half() || tile.slope) {
+          if (tiles.half(offset) || tiles.slope(offset)) {
             mask |= 0x10;
           }
 
@@ -817,24 +930,24 @@ void Map::drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
           renderer.addLiquid(copy, Textures::LiquidEdge | variant, x * 16 + xpad, y * 16 + ypad, LiquidEdgeLayer, waterw, waterh, v, alpha);
         }
       }
-      if (tile.liquid > 0 && (!tile.active() || !info->solid)) {
-        int waterLevel = (255 - tile.liquid) / 16.0;
+      if (tiles.liquid(offset) > 0 && (!tiles.active(offset) || !info->solid)) {
+        int waterLevel = (255 - tiles.liquid(offset)) / 16.0;
         int variant = 0;
         double alpha = 0.5;
-        if (tile.shimmer()) {
+        if (tiles.shimmer(offset)) {
           variant = 14;
           alpha = 0.85;
-        } else if (tile.honey()) {
+        } else if (tiles.honey(offset)) {
           variant = 11;
           alpha = 0.85;
-        } else if (tile.lava()) {
+        } else if (tiles.lava(offset)) {
           variant = 1;
           alpha = 0.9;
         }
         int v = 0;
         // ripple?
-        const auto &up = world.tiles[offset - stride];
-        if (up.liquid > 32 || (up.active() && world.info[up.type]->solid)) {
+        int up = offset - stride;
+        if (tiles.liquid(up) > 32 || (tiles.active(up) && world.info[tiles.type(up)]->solid)) {
           v = 4;
         }
         renderer.addLiquid(copy, Textures::Liquid | variant, x * 16, y * 16 + waterLevel, LiquidLayer, 16, 16 - waterLevel, v, alpha);
@@ -843,23 +956,23 @@ void Map::drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
   }
 }
 
-void Map::drawWires(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
+void Map::drawWires(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY) {
+  const auto &tiles = world.tiles;
   int stride = world.tilesWide;
-  for (int y = startY; y < endY; y++) {
-    int offset = y * stride + startX;
-    for (int x = startX; x < endX; x++, offset++) {
-      const auto &tile = world.tiles[offset];
-      if (tile.actuator()) {
+  for (int y = fromY; y < toY; y++) {
+    int offset = y * stride + fromX;
+    for (int x = fromX; x < toX; x++, offset++) {
+      if (tiles.actuator(offset)) {
         renderer.addTile(copy, Textures::Actuator, x * 16, y * 16, WireLayer, 16, 16, 0, 0, 0, false);
       }
       int voffset = 0;
-      if (tile.type == TileJunction) {
-        voffset = (tile.u / 18 + 1) * 72;
+      if (tiles.type(offset) == TileJunction) {
+        voffset = (tiles.u(offset) / 18 + 1) * 72;
       }
-      if (tile.type == TilePixel) {
+      if (tiles.type(offset) == TilePixel) {
         voffset = 72;
       }
-      int wires = tile.Is() & (IsRedWire | IsBlueWire | IsGreenWire | IsYellowWire);
+      int wires = tiles.is(offset) & (IsRedWire | IsBlueWire | IsGreenWire | IsYellowWire);
       if (wires) {
         if (wires & IsRedWire) {
           int mask = wireMask(x, y, IsRedWire);
@@ -894,7 +1007,7 @@ void Map::drawNPCs(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
       int hx = npc.homeX;
       int hy = npc.homeY - 1;
       int offset = hy * stride + hx;
-      while (!world.tiles[offset].active() || !world.info[world.tiles[offset].type]->solid) {
+      while (!world.tiles.active(offset) || !world.info[world.tiles.type(offset)]->solid) {
         hy--;
         offset -= stride;
         if (hy < 10) {
@@ -905,7 +1018,7 @@ void Map::drawNPCs(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
       offset += stride;
       if (hx >= startX && hx < endX && hy >= startY && hy < endY) {
         int dy = 18;
-        if (world.tiles[offset - stride].type == TilePlatforms) {
+        if (world.tiles.type(offset - stride) == TilePlatforms) {
           dy -= 8;
         }
         renderer.addHouse(copy, Textures::NPCHead | npc.head, hx * 16, hy * 16 + dy, HouseLayer);
@@ -915,25 +1028,34 @@ void Map::drawNPCs(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
 }
 
 int Map::wireMask(int x, int y, uint16_t color) {
+  const auto &tiles = world.tiles;
   int mask = 0;
   int offset = x + y * world.tilesWide;
-  if (y > 0 && (world.tiles[offset - world.tilesWide].Is() & color)) {
+  if (y > 0 && (tiles.is(offset - world.tilesWide) & color)) {
     mask |= 1;
   }
-  if (x < world.tilesWide && (world.tiles[offset + 1].Is() & color)) {
+  if (x < world.tilesWide && (tiles.is(offset + 1) & color)) {
     mask |= 2;
   }
-  if (y < world.tilesHigh - 1 && (world.tiles[offset + world.tilesWide].Is() & color)) {
+  if (y < world.tilesHigh - 1 && (tiles.is(offset + world.tilesWide) & color)) {
     mask |= 4;
   }
-  if (x > 0 && (world.tiles[offset - 1].Is() & color)) {
+  if (x > 0 && (tiles.is(offset - 1) & color)) {
     mask |= 8;
   }
   return mask;
 }
 
 void Map::drawFlat(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
-  renderer.addFlat(copy, world.colors, startX, startY, endX, endY, world.tilesWide, world.tilesHigh);
+  if (!world.colors || startX >= endX) {
+    return;
+  }
+  // the gpu picks the mip level for the zoom
+  std::vector<const uint8_t *> levels {world.colors};
+  for (int i = 0; i < world.mipLevels(); i++) {
+    levels.push_back(world.mips[i].get());
+  }
+  renderer.addFlat(copy, levels, startX, startY, endX, endY, world.tilesWide, world.tilesHigh);
 }
 
 void Map::drawHilited(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
@@ -955,22 +1077,36 @@ void Map::render(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *renderPass) {
 
 // call when scale is changed or map panned
 void Map::calcBounds() {
-  if (!world.loaded) {
+  if (bands == 0) {
     return;
   }
   dirty = true;
+  int left, right;
+  drawableColumns(&left, &right);
   glm::mat4 m = glm::inverse(project());
   auto pt = m * glm::vec4(-1, 1, 0, 1.0);  // top right corner 
-  startX = fmax(pt.x / 16 - 2, 0);
+  startX = fmax(pt.x / 16 - 2, left);
   startY = fmax(pt.y / 16 - 2, 0);
   pt = m * glm::vec4(1, -1, 0.0, 1.0);  // bottom left corner
-  endX = fmin(pt.x / 16 + 2, world.tilesWide);
+  endX = fmin(pt.x / 16 + 2, right);
   endY = fmin(pt.y / 16 + 2, world.tilesHigh);
 }
 
+// only draw what's been loaded so far, and stay clear of the edge
+// since drawing looks at neighboring tiles
+void Map::drawableColumns(int *left, int *right) {
+  world.loadedColumns(left, right);
+  if (*left > 0) {
+    *left += 2;
+  }
+  if (*right < world.tilesWide) {
+    *right -= 2;
+  }
+}
+
 int Map::getPalmVariant(int offset) {
   int var = 0;
-  switch (world.tiles[offset].type) {
+  switch (world.tiles.type(offset)) {
     case TileSand:
       var = 0;
       break;
@@ -991,7 +1127,7 @@ int Map::getPalmVariant(int offset) {
 }
 
 int Map::getTreeVariant(int offset) {
-  switch (world.tiles[offset].type) {
+  switch (world.tiles.type(offset)) {
     case TileCorruptGrass:
     case TileCorruptJungle:
       return 1;
@@ -1016,8 +1152,8 @@ int Map::getFoliage(int x, int y, int *variant, int *texw, int *texh) {
   *texh = 80;
   int offset = y * world.tilesWide + x;
   for (int i = 0; i < 100; i++) {
-    if (world.tiles[offset].active()) {
-      switch (world.tiles[offset].type) {
+    if (world.tiles.active(offset)) {
+      switch (world.tiles.type(offset)) {
         case TileGrass:
         case TileMowed:
           return world.header.treeStyle(x);
@@ -1100,9 +1236,8 @@ bool Map::hilite(std::shared_ptr<TileInfo> hilite, SDL_Mutex *mutex) {
   SDL_UnlockMutex(mutex);
   for (int y = 0; y < world.tilesHigh; y++) {
     for (int x = 0; x < world.tilesWide; x++, offset++) {
-      const auto &tile = world.tiles[offset];
-      if (tile.active()) {
-        if (world.info[tile] == hilite && count < 1000) {
+      if (world.tiles.active(offset)) {
+        if (world.info[world.tiles.type(offset)] == hilite.get() && count < 1000) {
           SDL_LockMutex(mutex);
           hilited.push_back(glm::vec2(x * 16, y * 16));
           SDL_UnlockMutex(mutex);
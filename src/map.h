@@ -17,6 +17,7 @@ class Map {
     bool setTextures(const std::filesystem::path &path);
     void setSize(int w, int h);
     bool load(std::string filename, SDL_Mutex *mutex);
+    void reset();
     bool loaded();
     bool failed();
     std::string progress();
@@ -38,11 +39,13 @@ class Map {
     glm::ivec2 mouseToTile(float x, float y);
 
   private:
-    void drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
-    void drawWalls(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
+    void prefetch();
+    void drawChunks(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
+    void drawTiles(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY);
+    void drawWalls(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY);
     void drawBackground(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
-    void drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
-    void drawWires(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
+    void drawLiquids(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY);
+    void drawWires(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int fromX, int fromY, int toX, int toY);
     void drawNPCs(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
     void drawFlat(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
     void drawHilited(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
@@ -52,6 +55,7 @@ class Map {
     int findBranchStyle(int x, int y);
     int wireMask(int x, int y, uint16_t color);
     void calcBounds();
+    void drawableColumns(int *left, int *right);
     glm::mat4 project();
 
     World &world;
@@ -61,6 +65,9 @@ class Map {
     float centerX, centerY, zoom = 1.0;
     int startX = 0, startY = 0, endX = 0, endY = 0;
     bool dirty = true;
+    int bands = 0;  // world.bands() when we last looked
+    int colored = 0;  // and world.coloredBands()
+    bool prefetched = false;
     std::vector<glm::vec2> hilited;
     glm::vec2 hiliteSize;
     bool textures;
@@ -0,0 +1,75 @@
+/** @copyright 2025 Sean Kasun */
+
+#include "parallel.h"
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <exception>
+#include <vector>
+
+struct ParallelJob {
+  const std::function<void(int, int)> *fn;
+  int count, batch;
+  SDL_AtomicInt next;
+  SDL_Mutex *mutex;
+  std::exception_ptr error;
+};
+
+static int parallelWorker(void *data) {
+  ParallelJob *job = (ParallelJob*)data;
+  while (true) {
+    int start = SDL_AddAtomicInt(&job->next, job->batch);
+    if (start >= job->count) {
+      break;
+    }
+    try {
+      (*job->fn)(start, std::min(start + job->batch, job->count));
+    } catch (...) {
+      SDL_LockMutex(job->mutex);
+      if (!job->error) {
+        job->error = std::current_exception();
+      }
+      SDL_UnlockMutex(job->mutex);
+      // stop handing out batches
+      SDL_SetAtomicInt(&job->next, job->count);
+      break;
+    }
+  }
+  return 0;
+}
+
+void parallelFor(int count, int batch, const std::function<void(int start, int end)> &fn) {
+  if (count <= 0) {
+    return;
+  }
+  batch = std::max(batch, 1);
+  int numBatches = (count + batch - 1) / batch;
+  int numThreads = std::min(SDL_GetNumLogicalCPUCores(), numBatches);
+  if (numThreads <= 1) {
+    fn(0, count);
+    return;
+  }
+
+  ParallelJob job;
+  job.fn = &fn;
+  job.count = count;
+  job.batch = batch;
+  SDL_SetAtomicInt(&job.next, 0);
+  job.mutex = SDL_CreateMutex();
+
+  // the calling thread is a worker too
+  std::vector<SDL_Thread*> threads;
+  for (int i = 1; i < numThreads; i++) {
+    SDL_Thread *thread = SDL_CreateThread(parallelWorker, "worker", &job);
+    if (thread) {
+      threads.push_back(thread);
+    }
+  }
+  parallelWorker(&job);
+  for (auto thread : threads) {
+    SDL_WaitThread(thread, nullptr);
+  }
+  SDL_DestroyMutex(job.mutex);
+  if (job.error) {
+    std::rethrow_exception(job.error);
+  }
+}
@@ -0,0 +1,11 @@
+/** @copyright 2025 Sean Kasun */
+
+#pragma once
+
+#include <functional>
+
+// Runs fn over [0, count) split into batches, using every core.
+// Idle workers grab the next unclaimed batch, so slow batches don't hold
+// up the rest.  The first exception thrown by fn is rethrown to the caller
+// once every worker has stopped.
+void parallelFor(int count, int batch, const std::function<void(int start, int end)> &fn);
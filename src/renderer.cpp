@@ -5,10 +5,17 @@
 #include "pipelines.h"
 #include "terrafirma.h"
 #include <SDL3/SDL_gpu.h>
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <memory>
+#include <tuple>
 
-static const int maxInstances = 512 * 512;
-static const int maxInstanceLen = maxInstances * sizeof(float) * 10;
+// the streamed buffers start here and double as the frame needs, up to max
+static const uint32_t initialStreamLen = 512 * 512 * sizeof(float) * 10;
+static const uint32_t maxStreamLen = 256 * 1024 * 1024;
+static const uint32_t chunkBufferLen = 64 * 1024 * 1024;
+static const uint32_t groupAlign = 256;  // safe vertex binding offset everywhere
 
 std::string Renderer::init(SDL_GPUDevice *gpu) {
   this->gpu = gpu;
@@ -17,21 +24,21 @@ std::string Renderer::init(SDL_GPUDevice *gpu) {
     return err;
   }
 
-  SDL_GPUTransferBufferCreateInfo transferInfo {
-    .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-    .size =  maxInstanceLen,
-  };
-  transfer = SDL_CreateGPUTransferBuffer(gpu, &transferInfo);
-  if (transfer == nullptr) {
+  if (!growStream(initialStreamLen)) {
     SDLFAIL();
   }
 
-  SDL_GPUBufferCreateInfo tileInfo {
+  SDL_GPUBufferCreateInfo chunkInfo {
     .usage = SDL_GPU_BUFFERUSAGE_VERTEX,
-    .size = maxInstanceLen,
+    .size = chunkBufferLen,
   };
-  tiles = SDL_CreateGPUBuffer(gpu, &tileInfo);
+  chunkBuffer = SDL_CreateGPUBuffer(gpu, &chunkInfo);
+  if (chunkBuffer == nullptr) {
+    SDLFAIL();
+  }
+  chunkHeap.reset(chunkBufferLen);
 
+  // atlas pages rely on this staying nearest, their sheets have no gutters
   SDL_GPUSamplerCreateInfo samplerInfo {
     .min_filter = SDL_GPU_FILTER_NEAREST,
     .mag_filter = SDL_GPU_FILTER_NEAREST,
@@ -52,30 +59,269 @@ std::string Renderer::init(SDL_GPUDevice *gpu) {
   };
   bgSampler = SDL_CreateGPUSampler(gpu, &bgSamplerInfo);
 
+  // the flat map is always zoomed out, so filter between its mip levels
+  SDL_GPUSamplerCreateInfo flatSamplerInfo {
+    .min_filter = SDL_GPU_FILTER_LINEAR,
+    .mag_filter = SDL_GPU_FILTER_NEAREST,
+    .mipmap_mode = SDL_GPU_SAMPLERMIPMAPMODE_LINEAR,
+    .address_mode_u = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
+    .address_mode_v = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
+    .address_mode_w = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
+    .max_lod = 1000.0f,
+  };
+  flatSampler = SDL_CreateGPUSampler(gpu, &flatSamplerInfo);
+
   return "";
 }
 
+// Mapping the transfer buffer with cycle on already rotates through a ring
+// of them while earlier frames are in flight, so all we do is make the pair
+// bigger.  The old ones are released once the gpu is done with them.
+bool Renderer::growStream(uint32_t len) {
+  SDL_GPUTransferBufferCreateInfo transferInfo {
+    .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+    .size = len,
+  };
+  auto newTransfer = SDL_CreateGPUTransferBuffer(gpu, &transferInfo);
+  if (newTransfer == nullptr) {
+    return false;
+  }
+  SDL_GPUBufferCreateInfo tileInfo {
+    .usage = SDL_GPU_BUFFERUSAGE_VERTEX,
+    .size = len,
+  };
+  auto newTiles = SDL_CreateGPUBuffer(gpu, &tileInfo);
+  if (newTiles == nullptr) {
+    SDL_ReleaseGPUTransferBuffer(gpu, newTransfer);
+    return false;
+  }
+  if (transfer != nullptr) {
+    SDL_ReleaseGPUTransferBuffer(gpu, transfer);
+    SDL_ReleaseGPUBuffer(gpu, tiles);
+  }
+  transfer = newTransfer;
+  tiles = newTiles;
+  streamLen = len;
+  return true;
+}
+
 bool Renderer::setTextures(const std::filesystem::path &path) {
-  return textures.setPath(path);
+  return textures.setPath(gpu, path);
 }
 
-void Renderer::clear() {
+void InstanceSet::clear() {
   toDraw.clear();
   toOverlay.clear();
-  tileInstances.clear();
-  backgroundInstances.clear();
-  liquidInstances.clear();
-  flatInstances.clear();
-  hiliteInstances.clear();
+  placeholders = false;
+}
+
+size_t InstanceSet::bytes() const {
+  size_t total = 0;
+  for (const auto *groups : {&toDraw, &toOverlay}) {
+    for (const auto &[slot, group] : *groups) {
+      total += group->instances.capacity();
+    }
+  }
+  return total;
+}
+
+void Renderer::clear() {
+  frame.clear();
+  visible.clear();
+}
+
+bool Renderer::beginChunk(uint32_t key) {
+  auto [chunk, added] = chunks.try_emplace(key);
+  chunk->second.drawn = chunkFrame;
+  visible.push_back(&chunk->second);
+  if (!added) {
+    return true;
+  }
+  adding = &chunk->second;
+  return false;
+}
+
+void Renderer::endChunk() {
+  adding = &frame;
+}
+
+void Renderer::resetChunks() {
+  chunks.clear();
+  visible.clear();
+  draws.clear();
+  overlays.clear();
+  chunkHeap.reset(chunkBufferLen);
+}
+
+std::unordered_map<uint32_t, InstanceSet>::iterator Renderer::evictChunk(std::unordered_map<uint32_t, InstanceSet>::iterator chunk) {
+  if (chunk->second.regionSize > 0) {
+    chunkHeap.free(chunk->second.region, chunk->second.regionSize);
+  }
+  return chunks.erase(chunk);
+}
+
+// textures still being decoded come back as a placeholder, and whatever
+// drew with one has to be drawn again once the real texture is uploaded
+SDL_GPUTexture *Renderer::texture(SDL_GPUCopyPass *copy, int slot) {
+  auto tex = textures.get(gpu, copy, slot);
+  if (tex != nullptr && tex == textures.placeholder()) {
+    adding->placeholders = true;
+  }
+  return tex;
 }
 
-void Renderer::addGroup(int slot, Pipeline pipeline, SDL_GPUTexture *tex, SDL_GPUSampler *sampler, glm::vec2 size, float z, size_t offset) {
-  std::shared_ptr<RenderData> group = nullptr;
-  if (pipeline == Pipeline::Hilite || pipeline == Pipeline::Liquid) {
-    group = toOverlay[slot];
-  } else {
-    group = toDraw[slot];
+bool Renderer::updateTextures(SDL_GPUCopyPass *copy) {
+  if (textures.upload(gpu, copy) == 0) {
+    return false;
   }
+  // prefetched textures land all the time, only redraw if something was waiting
+  bool redraw = frame.placeholders;
+  for (auto it = chunks.begin(); it != chunks.end();) {
+    if (it->second.placeholders) {
+      it = evictChunk(it);
+      redraw = true;
+    } else {
+      ++it;
+    }
+  }
+  if (redraw) {
+    visible.clear();
+    draws.clear();
+    overlays.clear();
+  }
+  return redraw;
+}
+
+// Lays out the chunk's groups one after the other and finds room for them
+// in the chunk buffer, evicting chunks that aren't on screen if we must.
+bool Renderer::placeChunk(InstanceSet &set) {
+  uint32_t size = 0;
+  for (auto *groups : {&set.toDraw, &set.toOverlay}) {
+    for (auto &[slot, group] : *groups) {
+      group->offset = size;
+      group->count = group->size();
+      size += (group->instances.size() + groupAlign - 1) / groupAlign * groupAlign;
+    }
+  }
+  uint32_t region;
+  while (size > 0 && !chunkHeap.alloc(size, &region)) {
+    auto oldest = chunks.end();
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+      if (it->second.resident && it->second.drawn != chunkFrame &&
+          (oldest == chunks.end() || it->second.drawn < oldest->second.drawn)) {
+        oldest = it;
+      }
+    }
+    if (oldest == chunks.end()) {
+      return false;  // the screen alone doesn't fit
+    }
+    evictChunk(oldest);
+  }
+  set.region = size > 0 ? region : 0;
+  set.regionSize = size;
+  for (auto *groups : {&set.toDraw, &set.toOverlay}) {
+    for (auto &[slot, group] : *groups) {
+      group->offset += set.region;
+    }
+  }
+  return true;
+}
+
+// New chunks are uploaded once, then drawn straight out of the chunk buffer
+// so panning over chunks we've already seen uploads nothing.
+void Renderer::uploadChunks(SDL_GPUCopyPass *copy) {
+  std::vector<InstanceSet *> placed;
+  uint32_t total = 0;
+  for (auto *set : visible) {
+    if (!set->resident && placeChunk(*set)) {
+      placed.push_back(set);
+      total += set->regionSize;
+    }
+  }
+  if (total == 0) {
+    for (auto *set : placed) {
+      set->resident = true;
+    }
+    return;
+  }
+
+  SDL_GPUTransferBufferCreateInfo transferInfo {
+    .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+    .size = total,
+  };
+  auto staging = SDL_CreateGPUTransferBuffer(gpu, &transferInfo);
+  if (staging == nullptr) {
+    SDL_Log("Failed to stage chunks: %s", SDL_GetError());
+    for (auto *set : placed) {
+      chunkHeap.free(set->region, set->regionSize);
+      set->regionSize = 0;
+    }
+    return;
+  }
+  uint8_t *buf = (uint8_t*)SDL_MapGPUTransferBuffer(gpu, staging, false);
+  uint32_t start = 0;
+  for (auto *set : placed) {
+    for (auto *groups : {&set->toDraw, &set->toOverlay}) {
+      for (auto &[slot, group] : *groups) {
+        SDL_memcpy(buf + start + group->offset - set->region, group->instances.data(), group->instances.size());
+        // the gpu will have it
+        group->instances = {};
+      }
+    }
+    start += set->regionSize;
+  }
+  SDL_UnmapGPUTransferBuffer(gpu, staging);
+
+  start = 0;
+  for (auto *set : placed) {
+    if (set->regionSize > 0) {
+      SDL_GPUTransferBufferLocation source {
+        .transfer_buffer = staging,
+        .offset = start,
+      };
+      SDL_GPUBufferRegion dest {
+        .buffer = chunkBuffer,
+        .offset = set->region,
+        .size = set->regionSize,
+      };
+      // don't cycle, the rest of the buffer is still in use
+      SDL_UploadToGPUBuffer(copy, &source, &dest, false);
+      start += set->regionSize;
+    }
+    set->resident = true;
+  }
+  SDL_ReleaseGPUTransferBuffer(gpu, staging);
+}
+
+// drop the least recently drawn chunks until we're under budget.  Only
+// chunks that didn't fit in the chunk buffer still hold their instances.
+void Renderer::trimChunks() {
+  size_t total = 0;
+  for (const auto &chunk : chunks) {
+    total += chunk.second.bytes();
+  }
+  while (total > chunkBudget) {
+    auto oldest = chunks.end();
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+      if (it->second.drawn != chunkFrame && it->second.bytes() > 0 &&
+          (oldest == chunks.end() || it->second.drawn < oldest->second.drawn)) {
+        oldest = it;
+      }
+    }
+    if (oldest == chunks.end()) {
+      break;  // everything is on screen
+    }
+    total -= oldest->second.bytes();
+    evictChunk(oldest);
+  }
+  chunkFrame++;
+}
+
+// groups are keyed by layer too, since an atlas page holds both tiles and
+// things drawn on top of tiles
+RenderData *Renderer::addGroup(int slot, Pipeline pipeline, SDL_GPUTexture *tex, SDL_GPUSampler *sampler, glm::vec2 size, float z) {
+  uint64_t key = static_cast<uint64_t>(std::bit_cast<uint32_t>(z)) << 32 | static_cast<uint32_t>(slot);
+  auto &group = pipeline == Pipeline::Hilite || pipeline == Pipeline::Liquid ? adding->toOverlay[key] : adding->toDraw[key];
   if (group == nullptr) {
     group = std::make_shared<RenderData>();
     group->pipeline = pipeline;
@@ -83,23 +329,20 @@ void Renderer::addGroup(int slot, Pipeline pipeline, SDL_GPUTexture *tex, SDL_GP
     group->sampler = sampler;
     group->layer = z;
     group->uvdims = size;
-    if (pipeline == Pipeline::Hilite || pipeline == Pipeline::Liquid) {
-      toOverlay[slot] = group;
-    } else {
-      toDraw[slot] = group;
-    }
   }
-  group->offsets.push_back(offset);
+  return group.get();
 }
 
 void Renderer::addTile(SDL_GPUCopyPass *copy, int slot, float x, float y, float z, int w, int h, float u, float v, uint8_t paint, bool fliph, bool flipv) {
-  auto tex = textures.get(gpu, copy, slot);
+  auto tex = texture(copy, slot);
   if (tex == nullptr) {
     return;
   }
   auto size = textures.size(slot);
+  auto origin = textures.origin(slot);
+  auto bounds = textures.bounds(slot);
 
-  addGroup(slot, Pipeline::Tile, tex, sampler, size, z, tileInstances.size());
+  auto group = addGroup(textures.group(slot), Pipeline::Tile, tex, sampler, bounds, z);
 
   if (w == 0) {
     w = size.x;
@@ -120,108 +363,117 @@ void Renderer::addTile(SDL_GPUCopyPass *copy, int slot, float x, float y, float
     }
   }
 
-  tileInstances.emplace_back(glm::vec2(x, y),
-                             glm::vec2(w, h),
-                             glm::vec2((u + 0.5f) / size.x, (v + 0.5f) / size.y),
-                             paint, slope);
+  group->add(TileInstance{glm::vec2(x, y),
+                          glm::vec2(w, h),
+                          (origin + glm::vec2(u + 0.5f, v + 0.5f)) / bounds,
+                          paint, slope});
 }
 
 void Renderer::addSlope(SDL_GPUCopyPass *copy, int slot, int slope, float x, float y, float z, int w, int h, float u, float v, uint8_t paint) {
-  auto tex = textures.get(gpu, copy, slot);
+  auto tex = texture(copy, slot);
   if (tex == nullptr) {
     return;
   }
-  auto size = textures.size(slot);
-
-  addGroup(slot, Pipeline::Tile, tex, sampler, size, z, tileInstances.size());
-
-  tileInstances.emplace_back(glm::vec2(x, y),
-                             glm::vec2(w, h),
-                             glm::vec2((u + 0.5f) / size.x, (v + 0.5f) / size.y),
-                             paint, slope);
+  auto origin = textures.origin(slot);
+  auto bounds = textures.bounds(slot);
+
+  auto group = addGroup(textures.group(slot), Pipeline::Tile, tex, sampler, bounds, z);
+  group->add(TileInstance{glm::vec2(x, y),
+                          glm::vec2(w, h),
+                          (origin + glm::vec2(u + 0.5f, v + 0.5f)) / bounds,
+                          paint, static_cast<uint32_t>(slope)});
 }
 
 void Renderer::addHBG(SDL_GPUCopyPass *copy, int slot, float x, float y, float w, float h) {
   // special bg that only tiles horizontally
-  auto tex = textures.get(gpu, copy, slot);
+  auto tex = texture(copy, slot);
   if (tex == nullptr) {
     return;
   }
   auto size = textures.size(slot);
-  addGroup(slot, Pipeline::Background, tex, bgSampler, size, 0.5, backgroundInstances.size());
-  backgroundInstances.emplace_back(glm::vec2(x * 16, y * 16),
-                                   glm::vec2(w * 16, h * 16),
-                                   glm::vec2(size.x, h * 16));
+  auto group = addGroup(slot, Pipeline::Background, tex, bgSampler, size, 0.5);
+  group->add(BackgroundInstance{glm::vec2(x * 16, y * 16),
+                                glm::vec2(w * 16, h * 16),
+                                glm::vec2(size.x, h * 16)});
 }
 
 void Renderer::addBG(SDL_GPUCopyPass *copy, int slot, float x, float y, float w, float h) {
-  auto tex = textures.get(gpu, copy, slot);
+  auto tex = texture(copy, slot);
   if (tex == nullptr) {
     return;
   }
   auto size = textures.size(slot);
-  addGroup(slot, Pipeline::Background, tex, bgSampler, size, 0.5, backgroundInstances.size());
-  backgroundInstances.emplace_back(glm::vec2(x * 16, y * 16),
-                                   glm::vec2(w * 16, h * 16),
-                                   size);
+  auto group = addGroup(slot, Pipeline::Background, tex, bgSampler, size, 0.5);
+  group->add(BackgroundInstance{glm::vec2(x * 16, y * 16),
+                                glm::vec2(w * 16, h * 16),
+                                size});
 }
 
 void Renderer::addLiquid(SDL_GPUCopyPass *copy, int slot, int x, int y, float z, int w, int h, float v, float alpha) {
-  auto tex = textures.get(gpu, copy, slot);
+  auto tex = texture(copy, slot);
   if (tex == nullptr) {
     return;
   }
   auto size = textures.size(slot);
 
-  addGroup(slot, Pipeline::Liquid, tex, sampler, size, z, liquidInstances.size());
-  liquidInstances.emplace_back(glm::vec2(x, y),
-                               glm::vec2(w, h),
-                               glm::vec2(0, (v + 0.5f) / size.y),
-                               alpha);
+  auto group = addGroup(slot, Pipeline::Liquid, tex, sampler, size, z);
+  group->add(LiquidInstance{glm::vec2(x, y),
+                            glm::vec2(w, h),
+                            glm::vec2(0, (v + 0.5f) / size.y),
+                            alpha});
 }
 
 void Renderer::addHouse(SDL_GPUCopyPass *copy, int slot, float x, float y, float z) {
   int bannerSlot = Textures::Unique | Textures::Banner;
-  auto tex = textures.get(gpu, copy, bannerSlot);
+  auto tex = texture(copy, bannerSlot);
   if (tex == nullptr) {
     return;
   }
   auto size = textures.size(bannerSlot);
-  addGroup(bannerSlot, Pipeline::Tile, tex, sampler, size, z, tileInstances.size());
-  tileInstances.emplace_back(glm::vec2(x - size.x / 2, y - size.y / 2),
-                             glm::vec2(32, 40),
-                             glm::vec2(0, 0),
-                             0, 0);
+  auto group = addGroup(bannerSlot, Pipeline::Tile, tex, sampler, size, z);
+  group->add(TileInstance{glm::vec2(x - size.x / 2, y - size.y / 2),
+                          glm::vec2(32, 40),
+                          glm::vec2(0, 0),
+                          0, 0});
 
-  tex = textures.get(gpu, copy, slot);
+  tex = texture(copy, slot);
   if (tex == nullptr) {
     return;
   }
   size = textures.size(slot);
-  addGroup(slot, Pipeline::Tile, tex, sampler, size, z + 0.5, tileInstances.size());
-  tileInstances.emplace_back(glm::vec2(x - size.x / 2, y - size.y / 2),
-                             size,
-                             glm::vec2(0, 0),
-                             0, 0);
+  group = addGroup(slot, Pipeline::Tile, tex, sampler, size, z + 0.5);
+  group->add(TileInstance{glm::vec2(x - size.x / 2, y - size.y / 2),
+                          size,
+                          glm::vec2(0, 0),
+                          0, 0});
 }
 
 void Renderer::addHilite(SDL_GPUCopyPass *copy, float x, float y, float w, float h) {
   glm::vec2 size(w, h);
-  addGroup(Textures::Hilite, Pipeline::Hilite, nullptr, nullptr, size, 10.0f, hiliteInstances.size());
-  hiliteInstances.emplace_back(glm::vec2(x, y), size);
+  auto group = addGroup(Textures::Hilite, Pipeline::Hilite, nullptr, nullptr, size, 10.0f);
+  group->add(HiliteInstance{glm::vec2(x, y), size});
 }
 
-void Renderer::addFlat(SDL_GPUCopyPass *copy, void *data, float x, float y, float x2, float y2, uint32_t w, uint32_t h) {
-  auto tex = textures.flat(gpu, copy, data, w, h);
-  if (tex == nullptr) {
-    return;
+// only the flat textures that overlap [x, x2) x [y, y2) get drawn, and uploaded
+void Renderer::addFlat(SDL_GPUCopyPass *copy, const std::vector<const uint8_t *> &levels, float x, float y, float x2, float y2, uint32_t w, uint32_t h) {
+  const int size = Textures::FlatSize;
+  int across = (w + size - 1) / size;
+  for (int ty = static_cast<int>(y) / size; ty * size < y2; ty++) {
+    for (int tx = static_cast<int>(x) / size; tx * size < x2; tx++) {
+      auto tex = textures.flat(gpu, copy, levels, w, h, tx, ty);
+      if (tex == nullptr) {
+        continue;
+      }
+      glm::vec2 origin(tx * size, ty * size);
+      glm::vec2 from(fmax(x, origin.x), fmax(y, origin.y));
+      glm::vec2 to(fmin(x2, origin.x + size), fmin(y2, origin.y + size));
+      auto group = addGroup(Textures::Flat | (ty * across + tx), Pipeline::Flat, tex, flatSampler, glm::vec2(size * 16.0f), 1.0);
+      group->add(FlatInstance{from * 16.f, (to - from) * 16.f,
+                              (from - origin) / static_cast<float>(size),
+                              (to - from) / static_cast<float>(size)});
+    }
   }
-  auto size = textures.size(Textures::Flat);
-  addGroup(Textures::Flat, Pipeline::Flat, tex, sampler, size * 16.0f, 1.0, flatInstances.size());
-  glm::vec2 dims(x2 - x, y2 - y);
-  flatInstances.emplace_back(glm::vec2(x * 16, y * 16), dims * 16.f,
-                             glm::vec2(x, y) / size,
-                             glm::vec2(x2 - x, y2 - y) / size);
+  textures.trimFlat(gpu);
 }
 
 void Renderer::resetFlat() {
@@ -229,14 +481,37 @@ void Renderer::resetFlat() {
 }
 
 void Renderer::copy(SDL_GPUCopyPass *copy) {
-  uint8_t *buf = (uint8_t*)SDL_MapGPUTransferBuffer(gpu, transfer, true);
-  uint32_t offset = 0;
-  for (auto &d : toDraw) {
-    offset = copyGroup(copy, buf, d.second, offset);
+  uploadChunks(copy);
+  streamed.clear();
+  for (const auto *set : visible) {
+    if (!set->resident) {
+      streamed.push_back(set);
+    }
   }
-  for (auto &d : toOverlay) {
-    offset = copyGroup(copy, buf, d.second, offset);
+  streamed.push_back(&frame);
+
+  // make room for every streamed instance
+  size_t needed = 0;
+  for (const auto *set : streamed) {
+    for (const auto *groups : {&set->toDraw, &set->toOverlay}) {
+      for (const auto &[slot, group] : *groups) {
+        needed += group->instances.size();
+      }
+    }
   }
+  if (needed > streamLen && streamLen < maxStreamLen) {
+    uint32_t len = streamLen;
+    while (len < needed && len < maxStreamLen) {
+      len *= 2;
+    }
+    if (!growStream(std::min(len, maxStreamLen))) {
+      SDL_Log("Failed to grow instance buffers: %s", SDL_GetError());
+    }
+  }
+  droppedInstances = 0;
+  uint8_t *buf = (uint8_t*)SDL_MapGPUTransferBuffer(gpu, transfer, true);
+  uint32_t offset = mergeGroups(buf, false, 0);
+  offset = mergeGroups(buf, true, offset);
   SDL_UnmapGPUTransferBuffer(gpu, transfer);
 
   SDL_GPUTransferBufferLocation source {
@@ -251,57 +526,112 @@ void Renderer::copy(SDL_GPUCopyPass *copy) {
   };
 
   SDL_UploadToGPUBuffer(copy, &source, &dest, true);
+  if (droppedInstances > 0) {
+    SDL_Log("Dropped %u instances that didn't fit", droppedInstances);
+  }
+  trimChunks();
+  sortDraws();
 }
 
-uint32_t Renderer::copyGroup(SDL_GPUCopyPass *copy, uint8_t *buf, std::shared_ptr<RenderData> group, uint32_t offset) {
-  group->offset = offset;
-  uint8_t *src = nullptr;
-  int blocklen = 0;
-  switch (group->pipeline) {
-    case Pipeline::Tile:
-      src = (uint8_t*)tileInstances.data();
-      blocklen = sizeof(TileInstance);
-      break;
-    case Pipeline::Background:
-      src = (uint8_t*)backgroundInstances.data();
-      blocklen = sizeof(BackgroundInstance);
-      break;
-    case Pipeline::Liquid:
-      src = (uint8_t*)liquidInstances.data();
-      blocklen = sizeof(LiquidInstance);
-      break;
-    case Pipeline::Flat:
-      src = (uint8_t*)flatInstances.data();
-      blocklen = sizeof(FlatInstance);
-      break;
-    case Pipeline::Hilite:
-      src = (uint8_t*)hiliteInstances.data();
-      blocklen = sizeof(HiliteInstance);
-      break;
-  }
-  for (auto i : group->offsets) {
-    if (offset + blocklen < maxInstanceLen) {
-      SDL_memcpy(buf + offset, src + i * blocklen, blocklen);
-      offset += blocklen;
+// every streamed set's instances for a slot end up next to each other, so
+// the slot is drawn once no matter how many sets it's in
+uint32_t Renderer::mergeGroups(uint8_t *buf, bool overlay, uint32_t offset) {
+  auto &merged = overlay ? toOverlay : toDraw;
+  merged.clear();
+  for (const auto *set : streamed) {
+    for (const auto &[slot, group] : overlay ? set->toOverlay : set->toDraw) {
+      if (!merged.contains(slot)) {
+        auto m = std::make_shared<RenderData>();
+        m->uvdims = group->uvdims;
+        m->layer = group->layer;
+        m->pipeline = group->pipeline;
+        m->sampler = group->sampler;
+        m->tex = group->tex;
+        merged[slot] = m;
+      }
+    }
+  }
+  for (auto &[slot, group] : merged) {
+    group->offset = offset;
+    for (const auto *set : streamed) {
+      const auto &groups = overlay ? set->toOverlay : set->toDraw;
+      if (auto from = groups.find(slot); from != groups.end()) {
+        offset = copyGroup(buf, from->second, group, offset);
+      }
     }
   }
   return offset;
 }
 
+// the group's instances are already packed, so it's one copy
+uint32_t Renderer::copyGroup(uint8_t *buf, std::shared_ptr<RenderData> from, std::shared_ptr<RenderData> group, uint32_t offset) {
+  uint32_t count = from->size();
+  if (from->stride > 0 && offset + from->instances.size() > streamLen) {
+    count = (streamLen - offset) / from->stride;
+    droppedInstances += from->size() - count;
+  }
+  SDL_memcpy(buf + offset, from->instances.data(), count * from->stride);
+  group->count += count;
+  return offset + count * from->stride;
+}
+
+// Draw order only depends on what's being drawn, never on hash order or
+// pointers, and draws that share a pipeline and texture end up together.
+// Opaque draws go front to back, transparent ones back to front.
+void Renderer::sortDraws() {
+  draws.clear();
+  overlays.clear();
+  for (const auto *set : visible) {
+    if (set->resident) {
+      for (const auto &[key, group] : set->toDraw) {
+        draws.push_back({group.get(), chunkBuffer, key});
+      }
+      for (const auto &[key, group] : set->toOverlay) {
+        overlays.push_back({group.get(), chunkBuffer, key});
+      }
+    }
+  }
+  for (const auto &[key, group] : toDraw) {
+    draws.push_back({group.get(), tiles, key});
+  }
+  for (const auto &[key, group] : toOverlay) {
+    overlays.push_back({group.get(), tiles, key});
+  }
+  auto order = [this](const Draw &d, float layer) {
+    return std::make_tuple(layer, d.group->pipeline, d.key, d.buffer == tiles, d.group->offset);
+  };
+  std::sort(draws.begin(), draws.end(), [&order](const Draw &a, const Draw &b) {
+    return order(a, -a.group->layer) < order(b, -b.group->layer);
+  });
+  std::sort(overlays.begin(), overlays.end(), [&order](const Draw &a, const Draw &b) {
+    return order(a, a.group->layer) < order(b, b.group->layer);
+  });
+}
+
 void Renderer::render(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *render, const glm::mat4 &ortho) {
-  for (const auto &i: toDraw) {
-    renderGroup(cmd, render, ortho, i.second);
+  bound = {};
+  stateChanges = 0;
+  for (const auto &draw : draws) {
+    renderGroup(cmd, render, ortho, draw);
   }
   // render transparent last
-  for (const auto &i: toOverlay) {
-    renderGroup(cmd, render, ortho, i.second);
+  for (const auto &draw : overlays) {
+    renderGroup(cmd, render, ortho, draw);
   }
 }
 
-void Renderer::renderGroup(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *render, const glm::mat4 &ortho, std::shared_ptr<RenderData> group) {
-  SDL_BindGPUGraphicsPipeline(render, pipelines.get(group->pipeline));
-    SDL_GPUBufferBinding vertexBinding = {
-    .buffer = tiles,
+void Renderer::renderGroup(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *render, const glm::mat4 &ortho, const Draw &draw) {
+  const auto *group = draw.group;
+  auto pipeline = pipelines.get(group->pipeline);
+  if (bound.pipeline != pipeline) {
+    SDL_BindGPUGraphicsPipeline(render, pipeline);
+    bound.pipeline = pipeline;
+    bound.tex = nullptr;  // new pipeline, rebind everything
+    bound.sampler = nullptr;
+    stateChanges++;
+  }
+  SDL_GPUBufferBinding vertexBinding = {
+    .buffer = draw.buffer,
     .offset = group->offset,
   };
 
@@ -327,12 +657,15 @@ void Renderer::renderGroup(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *render,
   ub.layer = group->layer;
 
   SDL_BindGPUVertexBuffers(render, 0, &vertexBinding, 1);
-  if (group->pipeline != Pipeline::Hilite) {
+  if (group->pipeline != Pipeline::Hilite && (bound.tex != group->tex || bound.sampler != group->sampler)) {
     SDL_BindGPUFragmentSamplers(render, 0, &textureBinding, 1);
+    bound.tex = group->tex;
+    bound.sampler = group->sampler;
+    stateChanges++;
   }
   SDL_PushGPUVertexUniformData(cmd, 0, &ub, sizeof(ub));
   SDL_PushGPUFragmentUniformData(cmd, 0, &fub, sizeof(fub));
-  SDL_DrawGPUPrimitives(render, 4, group->offsets.size(), 0, 0);
+  SDL_DrawGPUPrimitives(render, 4, group->count, 0, 0);
 }
 
 void Renderer::hiliteBlock(bool hilite) {
@@ -4,6 +4,7 @@
 
 #include "textures.h"
 #include "pipelines.h"
+#include "bufferheap.h"
 
 #include <filesystem>
 #include <SDL3/SDL_gpu.h>
@@ -11,6 +12,8 @@
 #include <glm/ext/vector_float2.hpp>
 #include <unordered_map>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <vector>
 
 struct FlatInstance {
@@ -49,45 +52,114 @@ struct LiquidInstance {
 struct RenderData {
   glm::vec2 uvdims;
   float layer;
-  uint32_t offset;
+  uint32_t offset;  // in bytes, into whichever buffer it was uploaded to
+  uint32_t count = 0;  // instances copied to the gpu
   Pipeline pipeline;
   SDL_GPUSampler *sampler;
   SDL_GPUTexture *tex;
-  std::vector<uint32_t> offsets;
+  // packed back to back, so the whole group is copied at once
+  std::vector<uint8_t> instances;
+  uint32_t stride = 0;
+  template <class T> void add(const T &instance) {
+    stride = sizeof(T);
+    auto at = instances.size();
+    instances.resize(at + sizeof(T));
+    std::memcpy(instances.data() + at, &instance, sizeof(T));
+  }
+  uint32_t size() const { return stride ? instances.size() / stride : 0; }
+};
+
+// one group to draw, out of whichever buffer it lives in
+struct Draw {
+  const RenderData *group;
+  SDL_GPUBuffer *buffer;
+  uint64_t key;
+};
+
+// Instances that were added together, grouped by what they're drawn with.
+// Map builds one for each chunk of the world and the renderer keeps them,
+// so panning only has to build the chunks that scroll into view.  Chunks
+// are uploaded once into their own region of the chunk buffer, after which
+// their instances are dropped and only the groups' offsets are kept.
+struct InstanceSet {
+  std::unordered_map<uint64_t, std::shared_ptr<RenderData>> toDraw;
+  std::unordered_map<uint64_t, std::shared_ptr<RenderData>> toOverlay;
+  uint64_t drawn = 0;  // chunkFrame when it was last drawn
+  bool resident = false;  // lives in the chunk buffer
+  bool placeholders = false;  // drew something whose texture wasn't ready
+  uint32_t region = 0, regionSize = 0;
+  void clear();
+  size_t bytes() const;
 };
 
 class Renderer {
   public:
     std::string init(SDL_GPUDevice *gpu);
     bool setTextures(const std::filesystem::path &path);
+    void prefetch(const std::vector<int> &slots) { textures.prefetch(slots); }
     void addTile(SDL_GPUCopyPass *copy, int slot, float x, float y, float z, int w, int h, float u, float v, uint8_t paint, bool fliph = false, bool flipv = false);
     void addSlope(SDL_GPUCopyPass *copy, int slot, int slope, float x, float y, float z, int w, int h, float u, float v, uint8_t paint);
     void addHBG(SDL_GPUCopyPass *copy, int slot, float x, float y, float w, float h);
     void addBG(SDL_GPUCopyPass *copy, int slot, float x, float y, float w, float h);
     void addLiquid(SDL_GPUCopyPass *copy, int slot, int x, int y, float z, int w, int h, float v, float alpha);
     void addHouse(SDL_GPUCopyPass *copy, int slot, float x, float y, float z);
-    void addFlat(SDL_GPUCopyPass *copy, void *data, float x, float y, float x2, float y2, uint32_t w, uint32_t h);
+    void addFlat(SDL_GPUCopyPass *copy, const std::vector<const uint8_t *> &levels, float x, float y, float x2, float y2, uint32_t w, uint32_t h);
     void addHilite(SDL_GPUCopyPass *copy, float x, float y, float w, float h);
     void copy(SDL_GPUCopyPass *copy);
     void render(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *render, const glm::mat4 &ortho);
     void hiliteBlock(bool hilite);
     void resetFlat();
     void clear();
+    // Returns true if the chunk is cached and will be drawn as is.  If not,
+    // everything added until endChunk() is cached as that chunk.
+    bool beginChunk(uint32_t key);
+    void endChunk();
+    // drop every cached chunk, when what they'd draw has changed
+    void resetChunks();
+    // Uploads textures that finished decoding.  Returns true if anything was
+    // drawn with a placeholder, those chunks are dropped and need redrawing.
+    bool updateTextures(SDL_GPUCopyPass *copy);
+    // instances the last copy() had no room for
+    uint32_t dropped() const { return droppedInstances; }
+    // pipeline and texture binds the last render() needed
+    uint32_t changes() const { return stateChanges; }
   private:
-    void addGroup(int slot, Pipeline pipeline, SDL_GPUTexture *tex, SDL_GPUSampler *sampler, glm::vec2 size, float z, size_t offset);
-    uint32_t copyGroup(SDL_GPUCopyPass *copy, uint8_t *buf, std::shared_ptr<RenderData> group, uint32_t offset);
-    void renderGroup(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *render, const glm::mat4 &ortho, std::shared_ptr<RenderData> group);
-    SDL_GPUDevice *gpu;
-    SDL_GPUTransferBuffer *transfer;
-    SDL_GPUSampler *sampler, *bgSampler;
-    SDL_GPUBuffer *tiles;
-    std::unordered_map<uint16_t, std::shared_ptr<RenderData>> toDraw;
-    std::unordered_map<uint16_t, std::shared_ptr<RenderData>> toOverlay;
-    std::vector<TileInstance> tileInstances;
-    std::vector<BackgroundInstance> backgroundInstances;
-    std::vector<LiquidInstance> liquidInstances;
-    std::vector<FlatInstance> flatInstances;
-    std::vector<HiliteInstance> hiliteInstances;
+    bool growStream(uint32_t len);
+    RenderData *addGroup(int slot, Pipeline pipeline, SDL_GPUTexture *tex, SDL_GPUSampler *sampler, glm::vec2 size, float z);
+    uint32_t mergeGroups(uint8_t *buf, bool overlay, uint32_t offset);
+    uint32_t copyGroup(uint8_t *buf, std::shared_ptr<RenderData> from, std::shared_ptr<RenderData> group, uint32_t offset);
+    void uploadChunks(SDL_GPUCopyPass *copy);
+    bool placeChunk(InstanceSet &set);
+    std::unordered_map<uint32_t, InstanceSet>::iterator evictChunk(std::unordered_map<uint32_t, InstanceSet>::iterator chunk);
+    SDL_GPUTexture *texture(SDL_GPUCopyPass *copy, int slot);
+    void trimChunks();
+    void sortDraws();
+    void renderGroup(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *render, const glm::mat4 &ortho, const Draw &draw);
+    SDL_GPUDevice *gpu = nullptr;  // setTextures() can come before init()
+    SDL_GPUTransferBuffer *transfer = nullptr;
+    SDL_GPUSampler *sampler, *bgSampler, *flatSampler;
+    SDL_GPUBuffer *tiles = nullptr;
+    uint32_t streamLen = 0;
+    uint32_t droppedInstances = 0;
+    SDL_GPUBuffer *chunkBuffer;
+    BufferHeap chunkHeap;
+    // every streamed set's groups merged by slot, so each slot is one draw
+    std::unordered_map<uint64_t, std::shared_ptr<RenderData>> toDraw;
+    std::unordered_map<uint64_t, std::shared_ptr<RenderData>> toOverlay;
+    InstanceSet frame;  // what isn't cached, rebuilt every time
+    InstanceSet *adding = &frame;
+    std::unordered_map<uint32_t, InstanceSet> chunks;
+    std::vector<InstanceSet *> visible;
+    std::vector<const InstanceSet *> streamed;  // uploaded every copy()
+    std::vector<Draw> draws, overlays;  // in the order they're rendered
+    struct {
+      SDL_GPUGraphicsPipeline *pipeline;
+      SDL_GPUTexture *tex;
+      SDL_GPUSampler *sampler;
+    } bound;
+    uint32_t stateChanges = 0;
+    uint64_t chunkFrame = 0;
+    size_t chunkBudget = 64 * 1024 * 1024;
     Textures textures;
     Pipelines pipelines;
     bool hiliting = false;
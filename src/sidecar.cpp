@@ -0,0 +1,37 @@
+/** @copyright 2025 Sean Kasun */
+
+#include "sidecar.h"
+#include <SDL3/SDL_filesystem.h>
+#include <SDL3/SDL.h>
+
+uint64_t hashBytes(const uint8_t *data, int64_t len, uint64_t hash) {
+  for (int64_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void writeU32(std::ofstream &f, uint32_t v) {
+  uint8_t b[4] = {
+    static_cast<uint8_t>(v), static_cast<uint8_t>(v >> 8),
+    static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 24),
+  };
+  f.write(reinterpret_cast<const char*>(b), 4);
+}
+
+void writeU64(std::ofstream &f, uint64_t v) {
+  writeU32(f, v);
+  writeU32(f, v >> 32);
+}
+
+std::filesystem::path prefFile(const std::string &subdir, const std::filesystem::path &source, const std::string &ext) {
+  char *prefdir = SDL_GetPrefPath("seancode", "terrafirma");
+  std::filesystem::path dir = prefdir;
+  SDL_free(prefdir);
+  std::string path = std::filesystem::absolute(source).string();
+  char name[32];
+  SDL_snprintf(name, sizeof(name), "%016llx",
+               static_cast<unsigned long long>(hashBytes(reinterpret_cast<const uint8_t*>(path.data()), path.length())));
+  return dir / subdir / (name + ext);
+}
@@ -0,0 +1,18 @@
+/** @copyright 2025 Sean Kasun */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// Helpers for the files we keep in the preferences folder alongside what
+// they describe, like tile indexes and decoded textures.
+
+// FNV-1a, stable across runs and platforms unlike std::hash
+uint64_t hashBytes(const uint8_t *data, int64_t len, uint64_t hash = 0xcbf29ce484222325ull);
+void writeU32(std::ofstream &f, uint32_t v);
+void writeU64(std::ofstream &f, uint64_t v);
+// <prefs>/subdir/<hash of source's absolute path>.ext
+std::filesystem::path prefFile(const std::string &subdir, const std::filesystem::path &source, const std::string &ext);
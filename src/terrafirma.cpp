@@ -523,8 +523,7 @@ void Terrafirma::openWorld(std::string file) {
   }
   loadMutex = SDL_CreateMutex();
   LoadWorld *info = new LoadWorld;
-  world.loaded = false;
-  world.failed = false;
+  map.reset();
   info->map = &map;
   info->file = file;
   info->mutex = loadMutex;
@@ -0,0 +1,97 @@
+/** @copyright 2025 Sean Kasun */
+
+#include "texturecache.h"
+#include "handle.h"
+#include "sidecar.h"
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_thread.h>
+#include <fstream>
+
+static const char *cacheMagic = "TFTX";
+static const uint32_t cacheVersion = 1;
+static const uint32_t maxSize = 16384;  // the biggest texture every GPU can take
+
+TextureCache::TextureCache() = default;
+TextureCache::~TextureCache() = default;
+
+std::filesystem::path TextureCache::cacheFile(const std::filesystem::path &source) {
+  return prefFile("textures", source, ".tex");
+}
+
+bool TextureCache::stamp(const std::filesystem::path &source, uint64_t *size, int64_t *mtime) {
+  std::error_code ec;
+  *size = std::filesystem::file_size(source, ec);
+  if (ec) {
+    return false;
+  }
+  *mtime = std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+  return !ec;
+}
+
+bool TextureCache::open(const std::filesystem::path &source) {
+  uint64_t size;
+  int64_t mtime;
+  if (!stamp(source, &size, &mtime)) {
+    return false;
+  }
+  auto cached = std::make_unique<Handle>(cacheFile(source).string());
+  if (!cached->isOpen()) {
+    return false;
+  }
+  try {
+    if (cached->read(4) != cacheMagic || cached->r32() != cacheVersion ||
+        cached->r64() != size || static_cast<int64_t>(cached->r64()) != mtime) {
+      return false;
+    }
+    width = cached->r32();
+    height = cached->r32();
+    uint64_t bytes = static_cast<uint64_t>(width) * height * 4;
+    if (width > maxSize || height > maxSize || bytes != static_cast<uint64_t>(cached->remaining())) {
+      // truncated or corrupt, toss it so it gets written again
+      cached.reset();
+      std::error_code ec;
+      std::filesystem::remove(cacheFile(source), ec);
+      return false;
+    }
+    pixels = cached->readBytes(static_cast<int>(bytes));
+  } catch (HandleError &e) {
+    return false;
+  }
+  handle = std::move(cached);
+  return true;
+}
+
+void TextureCache::save(const std::filesystem::path &source, uint32_t width, uint32_t height, const uint8_t *pixels) {
+  uint64_t size;
+  int64_t mtime;
+  if (!stamp(source, &size, &mtime)) {
+    return;
+  }
+  auto path = cacheFile(source);
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  // two slots can share a file, so write somewhere private and swap it in
+  auto temp = path;
+  temp += "." + std::to_string(SDL_GetCurrentThreadID());
+  std::ofstream f(temp, std::ios::out | std::ios::binary);
+  if (!f.is_open()) {
+    SDL_Log("Couldn't write texture cache %s", temp.string().c_str());
+    return;
+  }
+  f.write(cacheMagic, 4);
+  writeU32(f, cacheVersion);
+  writeU64(f, size);
+  writeU64(f, mtime);
+  writeU32(f, width);
+  writeU32(f, height);
+  f.write(reinterpret_cast<const char*>(pixels), static_cast<std::streamsize>(width) * height * 4);
+  f.close();
+  if (f.fail()) {
+    std::filesystem::remove(temp, ec);
+    return;
+  }
+  std::filesystem::rename(temp, path, ec);
+  if (ec) {
+    std::filesystem::remove(temp, ec);
+  }
+}
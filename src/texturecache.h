@@ -0,0 +1,30 @@
+/** @copyright 2025 Sean Kasun */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+class Handle;
+
+// Keeps decoded textures in the preferences folder, so later launches can
+// map them straight in instead of inflating every XNB again.  Entries are
+// keyed by the XNB's path, and only used while its size and mtime match.
+class TextureCache {
+  public:
+    TextureCache();
+    ~TextureCache();
+    // maps the cached copy of source, false if there isn't a good one
+    bool open(const std::filesystem::path &source);
+    static void save(const std::filesystem::path &source, uint32_t width, uint32_t height, const uint8_t *pixels);
+
+    uint32_t width = 0, height = 0;
+    const uint8_t *pixels = nullptr;  // rgba, points into the mapping
+
+  private:
+    static std::filesystem::path cacheFile(const std::filesystem::path &source);
+    static bool stamp(const std::filesystem::path &source, uint64_t *size, int64_t *mtime);
+
+    std::unique_ptr<Handle> handle;
+};
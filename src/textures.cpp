@@ -5,119 +5,445 @@
 #include "lzx.h"
 #include "gui.h"
 #include <SDL3/SDL_gpu.h>
+#include <SDL3/SDL_thread.h>
+#include <algorithm>
 #include <filesystem>
+#include <memory>
 
-bool Textures::setPath(const std::filesystem::path &path) {
+Textures::~Textures() {
+  if (mutex == nullptr) {
+    return;
+  }
+  SDL_LockMutex(mutex);
+  stopping = true;
+  SDL_UnlockMutex(mutex);
+  SDL_BroadcastCondition(wake);
+  for (auto thread : threads) {
+    SDL_WaitThread(thread, nullptr);
+  }
+  SDL_DestroyCondition(wake);
+  SDL_DestroyMutex(mutex);
+}
+
+bool Textures::setPath(SDL_GPUDevice *gpu, const std::filesystem::path &path) {
+  for (auto &[slot, tex] : cache) {
+    if (tex != nullptr && !placements.contains(slot)) {  // pages are released below
+      SDL_ReleaseGPUTexture(gpu, tex);
+    }
+  }
+  for (auto &page : pages) {
+    SDL_ReleaseGPUTexture(gpu, page.tex);
+  }
   cache.clear();
   dims.clear();
+  queued.clear();
+  placements.clear();
+  pages.clear();
+  if (mutex != nullptr) {
+    SDL_LockMutex(mutex);
+    requests.clear();
+    finished.clear();
+    generation++;
+    SDL_UnlockMutex(mutex);
+  }
   root = path;
   // are there are images here?
-  return std::filesystem::is_directory(path) && std::filesystem::exists(path / "Tiles_0.xnb");
+  valid = std::filesystem::is_directory(path) && std::filesystem::exists(path / "Tiles_0.xnb");
+  return valid;
+}
+
+void Textures::prefetch(const std::vector<int> &slots) {
+  if (!valid) {
+    return;
+  }
+  for (int slot : slots) {
+    if (!cache.contains(slot) && !queued.contains(slot)) {
+      if (auto name = filename(slot); !name.empty()) {
+        load(slot, name, false);
+      }
+    }
+  }
 }
 
 SDL_GPUTexture *Textures::get(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int slot) {
-  if (cache[slot] == nullptr) {
-    TextureSlot mask = static_cast<TextureSlot>(slot & 0xff000);
-    int num = slot & 0xfff;
-    switch (mask) {
-      case Textures::Tile:
-        load(gpu, copy, slot, "Tiles_" + std::to_string(num));
-        break;
-      case Textures::Wall:
-        load(gpu, copy, slot, "Wall_" + std::to_string(num));
-        break;
-      case Textures::ArmorHead:
-        load(gpu, copy, slot, "Armor_Head_" + std::to_string(num));
-        break;
-      case Textures::ArmorBody:
-        load(gpu, copy, slot, "Armor/Armor_" + std::to_string(num));
-        break;
-      case Textures::ArmorLegs:
-        load(gpu, copy, slot, "Armor_Legs_" + std::to_string(num));
-        break;
-      case Textures::TreeTops:
-        load(gpu, copy, slot, "Tree_Tops_" + std::to_string(num));
-        break;
-      case Textures::TreeBranches:
-        load(gpu, copy, slot, "Tree_Branches_" + std::to_string(num));
-        break;
-      case Textures::Extra:
-        load(gpu, copy, slot, "Extra_" + std::to_string(num));
-        break;
-      case Textures::Xmas:
-        load(gpu, copy, slot, "Xmas_" + std::to_string(num));
-        break;
-      case Textures::Background:
-        load(gpu, copy, slot, "Background_" + std::to_string(num));
-        break;
-      case Textures::Underworld:
-        load(gpu, copy, slot, "Backgrounds/Underworld " + std::to_string(num));
-        break;
-      case Textures::Liquid:
-      case Textures::LiquidEdge:  // this is a separate slot for z-indexing
-        load(gpu, copy, slot, "Liquid_" + std::to_string(num));
-        break;
-      case Textures::NPC:
-        load(gpu, copy, slot, "NPC_" + std::to_string(num));
-        break;
-      case Textures::NPCHead:
-        load(gpu, copy, slot, "NPC_Head_" + std::to_string(num));
-        break;
-      case Textures::Unique:
-        switch (num) {
-          case Textures::Outline:
-            load(gpu, copy, slot, "Wall_Outline");
-            break;
-          case Textures::Shroom:
-            load(gpu, copy, slot, "Shroom_Tops");
-            break;
-          case Textures::Actuator:
-            load(gpu, copy, slot, "Actuator");
-            break;
-          case Textures::Wires:
-            load(gpu, copy, slot, "WiresNew");
-            break;
-          case Textures::Banner:
-            load(gpu, copy, slot, "House_Banner_1");
-            break;
-        }
-        break;
-      default:
-        FAIL("missing texture");
+  if (auto it = cache.find(slot); it != cache.end()) {
+    return it->second;
+  }
+  if (blank == nullptr) {
+    const uint8_t grey[] = {0x30, 0x30, 0x30, 0xff};
+    blank = create(gpu, copy, 1, 1, grey);
+  }
+  if (auto it = queued.find(slot); it == queued.end()) {
+    auto name = filename(slot);
+    if (name.empty()) {
+      cache[slot] = nullptr;  // nothing to load
+      return nullptr;
     }
+    load(slot, name, true);
+  } else if (!it->second) {
+    hurry(slot);  // prefetched, but it's on screen now
   }
-  return cache[slot];
+  return blank;
 }
 
+std::string Textures::filename(int slot) {
+  TextureSlot mask = static_cast<TextureSlot>(slot & 0xff000);
+  int num = slot & 0xfff;
+  switch (mask) {
+    case Textures::Tile:
+      return "Tiles_" + std::to_string(num);
+    case Textures::Wall:
+      return "Wall_" + std::to_string(num);
+    case Textures::ArmorHead:
+      return "Armor_Head_" + std::to_string(num);
+    case Textures::ArmorBody:
+      return "Armor/Armor_" + std::to_string(num);
+    case Textures::ArmorLegs:
+      return "Armor_Legs_" + std::to_string(num);
+    case Textures::TreeTops:
+      return "Tree_Tops_" + std::to_string(num);
+    case Textures::TreeBranches:
+      return "Tree_Branches_" + std::to_string(num);
+    case Textures::Extra:
+      return "Extra_" + std::to_string(num);
+    case Textures::Xmas:
+      return "Xmas_" + std::to_string(num);
+    case Textures::Background:
+      return "Background_" + std::to_string(num);
+    case Textures::Underworld:
+      return "Backgrounds/Underworld " + std::to_string(num);
+    case Textures::Liquid:
+    case Textures::LiquidEdge:  // this is a separate slot for z-indexing
+      return "Liquid_" + std::to_string(num);
+    case Textures::NPC:
+      return "NPC_" + std::to_string(num);
+    case Textures::NPCHead:
+      return "NPC_Head_" + std::to_string(num);
+    case Textures::Unique:
+      switch (num) {
+        case Textures::Outline:
+          return "Wall_Outline";
+        case Textures::Shroom:
+          return "Shroom_Tops";
+        case Textures::Actuator:
+          return "Actuator";
+        case Textures::Wires:
+          return "WiresNew";
+        case Textures::Banner:
+          return "House_Banner_1";
+      }
+      return "";
+    default:
+      FAIL("missing texture");
+  }
+  return "";
+}
+
+// the placeholder doesn't care, so pretend it's a tile
 glm::vec2 Textures::size(int slot) {
-  return dims[slot];
+  if (auto it = dims.find(slot); it != dims.end()) {
+    return it->second;
+  }
+  return glm::vec2(16, 16);
 }
 
-SDL_GPUTexture *Textures::flat(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, void *data, uint32_t w, uint32_t h) {
-  auto tex = cache[Flat];
-  if (tex) {
-    return tex;
+// enough for the whole screen at minimum zoom on a large world, plus change
+static const size_t flatBudget = 256 << 20;
+
+SDL_GPUTexture *Textures::flat(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, const std::vector<const uint8_t *> &levels, uint32_t w, uint32_t h, int tx, int ty) {
+  int index = ty * ((w + FlatSize - 1) / FlatSize) + tx;
+  auto &flat = flats[index];
+  flat.drawn = flatFrame;
+  if (flat.tex) {
+    return flat.tex;
   }
+  // FlatSize is a power of two, so each of our levels lines up with the world's levels
+  uint32_t numLevels = SDL_min(static_cast<int>(levels.size()), FlatLevels);
   SDL_GPUTextureCreateInfo info {
     .type = SDL_GPU_TEXTURETYPE_2D,
     .format = SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM,
     .usage = SDL_GPU_TEXTUREUSAGE_SAMPLER,
-    .width = w,
-    .height = h,
+    .width = FlatSize,
+    .height = FlatSize,
     .layer_count_or_depth = 1,
-    .num_levels = 1,
+    .num_levels = numLevels,
   };
-  tex = SDL_CreateGPUTexture(gpu, &info);
-  cache[Flat] = tex;
-  dims[Flat] = glm::vec2(w, h);
-  uint32_t len = w * h * 4;
+  flat.tex = SDL_CreateGPUTexture(gpu, &info);
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < numLevels; i++) {
+    len += (FlatSize >> i) * (FlatSize >> i) * 4;
+  }
   SDL_GPUTransferBufferCreateInfo transferCreateInfo {
     .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
     .size = len,
   };
   SDL_GPUTransferBuffer *transfer = SDL_CreateGPUTransferBuffer(gpu, &transferCreateInfo);
-  void *dest = SDL_MapGPUTransferBuffer(gpu, transfer, true);
-  SDL_memcpy(dest, data, len);
+  uint8_t *dest = static_cast<uint8_t *>(SDL_MapGPUTransferBuffer(gpu, transfer, true));
+  SDL_memset(dest, 0, len);  // past the edge of the world is clear
+  uint32_t offset = 0;
+  for (uint32_t i = 0; i < numLevels; i++) {
+    int size = FlatSize >> i;
+    int lw = SDL_max(w >> i, 1), lh = SDL_max(h >> i, 1);
+    int x = tx * size, y = ty * size;
+    int cw = SDL_min(size, lw - x), ch = SDL_min(size, lh - y);
+    for (int row = 0; row < ch; row++) {
+      SDL_memcpy(dest + offset + row * size * 4, levels[i] + (static_cast<size_t>(y + row) * lw + x) * 4, cw * 4);
+    }
+    offset += size * size * 4;
+  }
+  SDL_UnmapGPUTransferBuffer(gpu, transfer);
+
+  offset = 0;
+  for (uint32_t i = 0; i < numLevels; i++) {
+    uint32_t size = FlatSize >> i;
+    SDL_GPUTextureTransferInfo transferInfo {
+      .transfer_buffer = transfer,
+      .offset = offset,
+    };
+    SDL_GPUTextureRegion region {
+      .texture = flat.tex,
+      .mip_level = i,
+      .w = size,
+      .h = size,
+      .d = 1,
+    };
+    SDL_UploadToGPUTexture(copy, &transferInfo, &region, true);
+    offset += size * size * 4;
+  }
+  SDL_ReleaseGPUTransferBuffer(gpu, transfer);
+  return flat.tex;
+}
+
+void Textures::trimFlat(SDL_GPUDevice *gpu) {
+  const size_t perTexture = FlatSize * FlatSize * 4 * 4 / 3;  // with mips
+  while (flats.size() * perTexture > flatBudget) {
+    auto oldest = flats.end();
+    for (auto it = flats.begin(); it != flats.end(); ++it) {
+      if (it->second.drawn != flatFrame && (oldest == flats.end() || it->second.drawn < oldest->second.drawn)) {
+        oldest = it;
+      }
+    }
+    if (oldest == flats.end()) {
+      break;  // everything is on screen
+    }
+    SDL_ReleaseGPUTexture(gpu, oldest->second.tex);
+    flats.erase(oldest);
+  }
+  flatFrame++;
+}
+
+void Textures::resetFlat(SDL_GPUDevice *gpu) {
+  for (auto &flat : flats) {
+    SDL_ReleaseGPUTexture(gpu, flat.second.tex);
+  }
+  flats.clear();
+}
+
+void Textures::load(int slot, const std::string name, bool urgent) {
+  if (mutex == nullptr) {
+    mutex = SDL_CreateMutex();
+    wake = SDL_CreateCondition();
+    // leave a core for the render thread
+    int workers = std::clamp(SDL_GetNumLogicalCPUCores() - 1, 1, 4);
+    for (int i = 0; i < workers; i++) {
+      threads.push_back(SDL_CreateThread(worker, "Textures", this));
+    }
+  }
+  queued[slot] = urgent;
+  SDL_LockMutex(mutex);
+  // whatever's on screen jumps ahead of the prefetches
+  if (urgent) {
+    requests.push_front({slot, generation, root / (name + ".xnb")});
+  } else {
+    requests.push_back({slot, generation, root / (name + ".xnb")});
+  }
+  SDL_UnlockMutex(mutex);
+  SDL_SignalCondition(wake);
+}
+
+// moves a prefetch to the front of the line, unless a worker already has it
+void Textures::hurry(int slot) {
+  queued[slot] = true;
+  SDL_LockMutex(mutex);
+  auto it = std::find_if(requests.begin(), requests.end(), [slot](const Request &r) {
+    return r.slot == slot;
+  });
+  if (it != requests.end()) {
+    Request request = std::move(*it);
+    requests.erase(it);
+    requests.push_front(std::move(request));
+  }
+  SDL_UnlockMutex(mutex);
+}
+
+int Textures::worker(void *data) {
+  auto textures = static_cast<Textures *>(data);
+  SDL_LockMutex(textures->mutex);
+  while (true) {
+    while (textures->requests.empty() && !textures->stopping) {
+      SDL_WaitCondition(textures->wake, textures->mutex);
+    }
+    if (textures->stopping) {
+      break;
+    }
+    Request request = std::move(textures->requests.front());
+    textures->requests.pop_front();
+    SDL_UnlockMutex(textures->mutex);
+
+    Decoded decoded {
+      .slot = request.slot,
+      .generation = request.generation,
+    };
+    try {
+      decode(request.path, decoded);
+    } catch (HandleError &e) {
+      SDL_Log("Corrupt texture %s: %s", request.path.string().c_str(), e.reason.c_str());  // treat like a missing texture
+      decoded.pixels.clear();
+      decoded.cached.reset();
+    }
+
+    SDL_LockMutex(textures->mutex);
+    textures->finished.push_back(std::move(decoded));
+  }
+  SDL_UnlockMutex(textures->mutex);
+  return 0;
+}
+
+int Textures::upload(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy) {
+  if (mutex == nullptr) {
+    return 0;
+  }
+  std::vector<Decoded> done;
+  SDL_LockMutex(mutex);
+  done.swap(finished);
+  uint32_t current = generation;
+  SDL_UnlockMutex(mutex);
+
+  int uploaded = 0;
+  for (const auto &decoded : done) {
+    if (decoded.generation != current) {
+      continue;
+    }
+    queued.erase(decoded.slot);
+    upload(gpu, copy, decoded);
+    uploaded++;
+  }
+  return uploaded;
+}
+
+void Textures::upload(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, const Decoded &decoded) {
+  const uint8_t *pixels = decoded.data();
+  if (pixels == nullptr) {
+    cache[decoded.slot] = nullptr;
+    return;
+  }
+  dims[decoded.slot] = glm::vec2(decoded.width, decoded.height);
+  int mask = decoded.slot & 0xff000;
+  if ((mask == Tile || mask == Wall) && decoded.width <= AtlasSheet && decoded.height <= AtlasSheet) {
+    Placement at;
+    pack(gpu, decoded.width, decoded.height, &at);
+    auto &page = pages[at.page];
+    copyRegion(gpu, copy, page.tex, at.origin.x, at.origin.y, decoded.width, decoded.height, pixels, false);
+    placements[decoded.slot] = at;
+    cache[decoded.slot] = page.tex;
+    return;
+  }
+  cache[decoded.slot] = create(gpu, copy, decoded.width, decoded.height, pixels);
+}
+
+// Shelf packing, sheets go on the snuggest shelf they fit on, or start a
+// new shelf, or a new page.  Sheets arrive in no particular order so this
+// isn't tight, but a page still holds dozens of them.
+void Textures::pack(SDL_GPUDevice *gpu, uint32_t w, uint32_t h, Placement *at) {
+  for (size_t i = 0; i < pages.size(); i++) {
+    auto &page = pages[i];
+    Shelf *best = nullptr;
+    for (auto &shelf : page.shelves) {
+      if (h <= shelf.height && shelf.used + w <= AtlasSize && (best == nullptr || shelf.height < best->height)) {
+        best = &shelf;
+      }
+    }
+    bool roomy = page.top + h <= AtlasSize;
+    // don't waste a tall shelf on a short sheet if we can start another
+    if (best != nullptr && (best->height <= h * 2 || !roomy)) {
+      at->page = i;
+      at->origin = glm::vec2(best->used, best->y);
+      best->used += w;
+      return;
+    }
+    if (roomy) {
+      page.shelves.push_back({page.top, h, w});
+      at->page = i;
+      at->origin = glm::vec2(0, page.top);
+      page.top += h;
+      return;
+    }
+  }
+  SDL_GPUTextureCreateInfo info {
+    .type = SDL_GPU_TEXTURETYPE_2D,
+    .format = SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM,
+    .usage = SDL_GPU_TEXTUREUSAGE_SAMPLER,
+    .width = AtlasSize,
+    .height = AtlasSize,
+    .layer_count_or_depth = 1,
+    .num_levels = 1,
+  };
+  Page page;
+  page.tex = SDL_CreateGPUTexture(gpu, &info);
+  page.shelves.push_back({0, h, w});
+  page.top = h;
+  pages.push_back(page);
+  at->page = pages.size() - 1;
+  at->origin = glm::vec2(0, 0);
+}
+
+glm::vec2 Textures::origin(int slot) {
+  if (auto it = placements.find(slot); it != placements.end()) {
+    return it->second.origin;
+  }
+  return glm::vec2(0, 0);
+}
+
+glm::vec2 Textures::bounds(int slot) {
+  if (placements.contains(slot)) {
+    return glm::vec2(AtlasSize, AtlasSize);
+  }
+  return size(slot);
+}
+
+int Textures::group(int slot) {
+  if (auto it = placements.find(slot); it != placements.end()) {
+    return Atlas | it->second.page;
+  }
+  return slot;
+}
+
+SDL_GPUTexture *Textures::create(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, uint32_t width, uint32_t height, const uint8_t *pixels) {
+  SDL_GPUTextureCreateInfo info {
+    .type = SDL_GPU_TEXTURETYPE_2D,
+    .format = SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM,
+    .usage = SDL_GPU_TEXTUREUSAGE_SAMPLER,
+    .width = width,
+    .height = height,
+    .layer_count_or_depth = 1,
+    .num_levels = 1,
+  };
+
+  auto texture = SDL_CreateGPUTexture(gpu, &info);
+  copyRegion(gpu, copy, texture, 0, 0, width, height, pixels, true);
+  return texture;
+}
+
+// cycle must be off when other parts of the texture are already in use
+void Textures::copyRegion(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, SDL_GPUTexture *texture, uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint8_t *pixels, bool cycle) {
+  SDL_GPUTransferBufferCreateInfo transferCreateInfo {
+    .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+    .size = width * height * 4
+  };
+
+  SDL_GPUTransferBuffer *transfer = SDL_CreateGPUTransferBuffer(gpu, &transferCreateInfo);
+  uint8_t *data = static_cast<uint8_t*>(SDL_MapGPUTransferBuffer(gpu, transfer, true));
+  SDL_memcpy(data, pixels, width * height * 4);
   SDL_UnmapGPUTransferBuffer(gpu, transfer);
 
   SDL_GPUTextureTransferInfo transferInfo {
@@ -125,29 +451,32 @@ SDL_GPUTexture *Textures::flat(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, void *
     .offset = 0,
   };
   SDL_GPUTextureRegion region {
-    .texture = tex,
-    .w = w,
-    .h = h,
+    .texture = texture,
+    .x = x,
+    .y = y,
+    .w = width,
+    .h = height,
     .d = 1,
   };
-  SDL_UploadToGPUTexture(copy, &transferInfo, &region, true);
+  SDL_UploadToGPUTexture(copy, &transferInfo, &region, cycle);
   SDL_ReleaseGPUTransferBuffer(gpu, transfer);
-  return tex;
 }
 
-void Textures::resetFlat(SDL_GPUDevice *gpu) {
-  SDL_ReleaseGPUTexture(gpu, cache[Flat]);
-  cache[Flat] = nullptr;
-}
+// runs on a worker, so no gpu calls in here
+void Textures::decode(const std::filesystem::path &path, Decoded &out) {
+  auto cached = std::make_unique<TextureCache>();
+  if (cached->open(path)) {
+    out.width = cached->width;
+    out.height = cached->height;
+    out.cached = std::move(cached);
+    return;
+  }
 
-void Textures::load(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int slot, const std::string name) {
-  auto path = root / (name + ".xnb");
   Handle handle(path.string());
   if (!handle.isOpen()) {
     SDL_Log("Failed to open texture: %s", path.string().c_str());
     return;  // ignore missing textures
   }
-
   auto header = handle.r32();
   if (header != 0x77424e58 && header != 0x78424e58 && header != 0x6d424e58) {
     FAIL("Not a valid XNB");
@@ -160,17 +489,19 @@ void Textures::load(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int slot, const s
     FAIL("Invalid XNB version");
   }
 
-  bool rawAllocated = false;
+  std::unique_ptr<uint8_t[]> decompressed;
   uint8_t *raw = nullptr;
 
+  // the whole file's length, header included
   auto length = handle.r32();
   if (compressed) {
     auto decompLength = handle.r32();
-    uint8_t *p = handle.readBytes(length - 4);
-    uint8_t *endp = p + length - 4;
+    int64_t compLength = static_cast<int64_t>(length) - handle.tell();
+    uint8_t *p = handle.readBytes(compLength);
+    uint8_t *endp = p + compLength;
     length = decompLength;
-    raw = new uint8_t[length];
-    rawAllocated = true;
+    decompressed = std::make_unique<uint8_t[]>(length);
+    raw = decompressed.get();
     uint8_t *dp = raw;
     struct LZXstate *lzx = LZXinit(16);
     while (p < endp) {
@@ -189,12 +520,17 @@ void Textures::load(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int slot, const s
       if (compLen == 0 || decompLen == 0) {  // done
         break;
       }
+      if (p + compLen > endp || dp + decompLen > raw + length) {
+        LZXteardown(lzx);
+        handle.fail("LZX frame past the end of the texture");
+      }
       LZXdecompress(lzx, p, dp, compLen, decompLen);
       p += compLen;
       dp += decompLen;
     }
     LZXteardown(lzx);
   } else {
+    length -= handle.tell();
     raw = handle.readBytes(length);
   }
 
@@ -222,47 +558,12 @@ void Textures::load(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int slot, const s
   tex.r32();  // mipmap
   tex.r32();  // image length
 
-  SDL_GPUTextureCreateInfo info {
-    .type = SDL_GPU_TEXTURETYPE_2D,
-    .format = SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM,
-    .usage = SDL_GPU_TEXTUREUSAGE_SAMPLER,
-    .width = width,
-    .height = height,
-    .layer_count_or_depth = 1,
-    .num_levels = 1,
-  };
-
-  auto texture = SDL_CreateGPUTexture(gpu, &info);
-
-  SDL_GPUTransferBufferCreateInfo transferCreateInfo {
-    .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-    .size = info.width * info.height * 4
-  };
-
-  SDL_GPUTransferBuffer *transfer = SDL_CreateGPUTransferBuffer(gpu, &transferCreateInfo);
-  uint8_t *data = static_cast<uint8_t*>(SDL_MapGPUTransferBuffer(gpu, transfer, true));
   if (format != 0) {  // bgra32
     FAIL("Invalid format");
   }
-  SDL_memcpy(data, tex.readBytes(width * height * 4), width * height * 4);
-  SDL_UnmapGPUTransferBuffer(gpu, transfer);
-
-  SDL_GPUTextureTransferInfo transferInfo {
-    .transfer_buffer = transfer,
-    .offset = 0,
-  };
-  SDL_GPUTextureRegion region {
-    .texture = texture,
-    .w = info.width,
-    .h = info.height,
-    .d = 1,
-  };
-  SDL_UploadToGPUTexture(copy, &transferInfo, &region, true);
-  SDL_ReleaseGPUTransferBuffer(gpu, transfer);
-  
-  if (rawAllocated) {
-    delete []raw;
-  }
-  dims[slot] = glm::vec2(info.width, info.height);
-  cache[slot] = texture;
+  const uint8_t *pixels = tex.readBytes(width * height * 4);
+  out.width = width;
+  out.height = height;
+  out.pixels.assign(pixels, pixels + width * height * 4);
+  TextureCache::save(path, width, height, pixels);
 }
@@ -3,18 +3,51 @@
 #pragma once
 
 #include <SDL3/SDL_gpu.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_thread.h>
+#include "texturecache.h"
+#include <deque>
 #include <filesystem>
 #include <glm/ext/vector_float2.hpp>
 #include <unordered_map>
+#include <vector>
 
 class Textures {
   public:
-    bool setPath(const std::filesystem::path &path);
+    // stops the workers, they finish what they're decoding first
+    ~Textures();
+    // releases everything loaded from the old path
+    bool setPath(SDL_GPUDevice *gpu, const std::filesystem::path &path);
+    // Textures are decoded on worker threads.  Until one has been uploaded
+    // this hands back placeholder(), a plain 1x1 texture.
     SDL_GPUTexture *get(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int slot);
-    SDL_GPUTexture *flat(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, void *data, uint32_t w, uint32_t h);
+    SDL_GPUTexture *placeholder() const { return blank; }
+    // decode these in the background, most wanted first, so they're ready
+    // before they're needed
+    void prefetch(const std::vector<int> &slots);
+    // uploads everything the workers have finished, returns how many
+    int upload(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy);
+    // The flat map is split into FlatSize square textures, uploaded as they're needed.
+    // levels[0] is w x h, each level after that is half the size of the one before.
+    SDL_GPUTexture *flat(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, const std::vector<const uint8_t *> &levels, uint32_t w, uint32_t h, int tx, int ty);
+    // drop the least recently drawn flat textures until we're under budget
+    void trimFlat(SDL_GPUDevice *gpu);
     glm::vec2 size(int slot);
+    // Small tile and wall sheets share big atlas pages so they draw together.
+    // origin() is where the slot's sheet starts in its texture, bounds() is
+    // the size of that texture, and slots with the same group() share one.
+    // Sheets sit edge to edge with no gutter, so pages have no mips and must
+    // only be drawn with nearest sampling.
+    glm::vec2 origin(int slot);
+    glm::vec2 bounds(int slot);
+    int group(int slot);
     void resetFlat(SDL_GPUDevice *gpu);
 
+    static const int FlatSize = 1024;
+    static const int FlatLevels = 11;  // 1024x1024 down to 1x1
+    static const uint32_t AtlasSize = 4096;
+    static const uint32_t AtlasSheet = 1024;  // anything bigger gets its own texture
+
     enum TextureSlot {
       Tile = 0x1000,
       Wall = 0x2000,
@@ -28,23 +61,85 @@ class Textures {
       Background = 0xa000,
       Liquid = 0xb000,
       LiquidEdge = 0xc000,
+      Flat = 0xd000,  // | flat texture index
       NPC = 0xe000,
       NPCHead = 0xf000,
       Underworld = 0x10000,
+      Atlas = 0x11000,  // | page
       Unique = 0x0000,
       Outline = 0,
       Shroom = 1,
       Actuator = 2,
       Wires = 3,
       Banner = 4,
-      Flat = 5,
       Hilite = 6,
     };
 
   private:
-    void load(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, int slot, const std::string name);
+    struct Request {
+      int slot;
+      uint32_t generation;
+      std::filesystem::path path;
+    };
+    struct Decoded {
+      int slot;
+      uint32_t generation;
+      uint32_t width = 0, height = 0;
+      std::vector<uint8_t> pixels;
+      std::unique_ptr<TextureCache> cached;  // or this, if it came from the cache
+      // null if the texture is missing
+      const uint8_t *data() const {
+        if (cached) {
+          return cached->pixels;
+        }
+        return pixels.empty() ? nullptr : pixels.data();
+      }
+    };
+    static std::string filename(int slot);
+    void load(int slot, const std::string name, bool urgent);
+    void hurry(int slot);
+    static int worker(void *data);
+    static void decode(const std::filesystem::path &path, Decoded &out);
+    static SDL_GPUTexture *create(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, uint32_t width, uint32_t height, const uint8_t *pixels);
+    static void copyRegion(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, SDL_GPUTexture *texture, uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint8_t *pixels, bool cycle);
+    struct Placement {
+      int page;
+      glm::vec2 origin;
+    };
+    void pack(SDL_GPUDevice *gpu, uint32_t w, uint32_t h, Placement *at);
+    void upload(SDL_GPUDevice *gpu, SDL_GPUCopyPass *copy, const Decoded &decoded);
     std::filesystem::path root;
+    bool valid = false;
 
-    std::unordered_map<int, SDL_GPUTexture *>cache;
+    std::unordered_map<int, SDL_GPUTexture *>cache;  // nullptr if missing
     std::unordered_map<int, glm::vec2> dims;
+    SDL_GPUTexture *blank = nullptr;
+
+    struct Shelf {
+      uint32_t y, height, used;
+    };
+    struct Page {
+      SDL_GPUTexture *tex;
+      std::vector<Shelf> shelves;
+      uint32_t top = 0;  // where the next shelf goes
+    };
+    std::vector<Page> pages;
+    std::unordered_map<int, Placement> placements;
+
+    // shared with the workers
+    SDL_Mutex *mutex = nullptr;
+    SDL_Condition *wake = nullptr;
+    std::vector<SDL_Thread *> threads;
+    bool stopping = false;
+    std::deque<Request> requests;
+    std::vector<Decoded> finished;
+    uint32_t generation = 0;  // bumped when the path changes, so stale decodes are tossed
+    std::unordered_map<int, bool> queued;  // slot -> urgent
+
+    struct FlatTexture {
+      SDL_GPUTexture *tex;
+      uint64_t drawn;  // flatFrame when it was last drawn
+    };
+    std::unordered_map<int, FlatTexture> flats;
+    uint64_t flatFrame = 0;
 };
@@ -0,0 +1,95 @@
+/** @copyright 2025 Sean Kasun */
+
+#include "tileindex.h"
+#include "handle.h"
+#include "sidecar.h"
+#include <SDL3/SDL.h>
+#include <fstream>
+
+static const char *indexMagic = "TFTI";
+static const uint32_t indexVersion = 1;
+
+void TileIndex::open(const std::string &filename) {
+  this->filename = filename;
+  columns.clear();
+  std::error_code ec;
+  size = std::filesystem::file_size(filename, ec);
+  if (ec) {
+    size = 0;
+  }
+  mtime = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+  if (ec) {
+    mtime = 0;
+  }
+}
+
+std::filesystem::path TileIndex::indexFile() const {
+  return prefFile("index", filename, ".idx");
+}
+
+bool TileIndex::load(Handle &handle, int tilesWide) {
+  columns.clear();
+  // everything before the tiles: version, section table, and the world header
+  tilesStart = handle.tell();
+  handle.seek(0);
+  headerHash = hashBytes(handle.readBytes(tilesStart), tilesStart);
+
+  Handle index(indexFile().string());
+  if (!index.isOpen()) {
+    return false;
+  }
+  try {
+    if (index.read(4) != indexMagic || index.r32() != indexVersion ||
+        index.r64() != size || static_cast<int64_t>(index.r64()) != mtime ||
+        index.r64() != headerHash || static_cast<int64_t>(index.r64()) != tilesStart ||
+        static_cast<int>(index.r32()) != tilesWide + 1) {
+      return false;
+    }
+    int64_t last = tilesStart;
+    columns.reserve(tilesWide + 1);
+    for (int x = 0; x <= tilesWide; x++) {
+      int64_t offset = tilesStart + index.r32();
+      if (offset < last || offset > handle.length) {
+        columns.clear();
+        return false;
+      }
+      columns.push_back(offset);
+      last = offset;
+    }
+  } catch (HandleError &e) {
+    columns.clear();
+    return false;
+  }
+  return true;
+}
+
+void TileIndex::save() {
+  if (columns.empty() || size == 0) {
+    return;
+  }
+  auto path = indexFile();
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  std::ofstream f(path, std::ios::out | std::ios::binary);
+  if (!f.is_open()) {
+    SDL_Log("Couldn't write tile index %s", path.string().c_str());
+    return;
+  }
+  f.write(indexMagic, 4);
+  writeU32(f, indexVersion);
+  writeU64(f, size);
+  writeU64(f, mtime);
+  writeU64(f, headerHash);
+  writeU64(f, tilesStart);
+  writeU32(f, columns.size());
+  for (auto offset : columns) {
+    writeU32(f, offset - tilesStart);
+  }
+  f.close();
+}
+
+void TileIndex::remove() {
+  columns.clear();
+  std::error_code ec;
+  std::filesystem::remove(indexFile(), ec);
+}
@@ -0,0 +1,36 @@
+/** @copyright 2025 Sean Kasun */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+class Handle;
+
+// Remembers where each column of a world's tile section starts, so
+// reopening the same world can skip the pre-scan.  Indexes live in the
+// preferences folder, keyed by the world's size, mtime and header hash.
+class TileIndex {
+  public:
+    // remember which world we're about to load
+    void open(const std::string &filename);
+    // fills columns if a saved index matches this world.
+    // handle must be at the start of the tile section.
+    bool load(Handle &handle, int tilesWide);
+    void save();
+    void remove();
+
+    // tilesWide + 1 file offsets, the last is the end of the tile data
+    std::vector<int64_t> columns;
+
+  private:
+    std::filesystem::path indexFile() const;
+
+    std::string filename;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t headerHash = 0;
+    int64_t tilesStart = 0;
+};
@@ -1,88 +1,211 @@
 /** @copyright 2025 Sean Kasun */
 
 #include "tiles.h"
+#include <array>
 #include <bit>
+#include <cstring>
 
-int Tile::load(std::shared_ptr<Handle> handle, const std::vector<bool> &extra) {
-  TileFlags1 flags1 = std::bit_cast<TileFlags1>(handle->r8());
-  TileFlags2 flags2 = std::bit_cast<TileFlags2>(flags1.hasFlags2 ? handle->r8() : static_cast<uint8_t>(0));
-  TileFlags3 flags3 = std::bit_cast<TileFlags3>(flags2.hasFlags3 ? handle->r8() : static_cast<uint8_t>(0));
-  TileFlags4 flags4 = std::bit_cast<TileFlags4>(flags3.hasFlags4 ? handle->r8() : static_cast<uint8_t>(0));
-
-  if (flags1.active) {
-    is = IsActive;
-    type = handle->r8();
-    if (flags1.tile16) {
-      type |= handle->r8() << 8;
-    }
-    if (extra[type]) {
-      u = handle->r16();
-      v = handle->r16();
-    } else {
-      u = v = -1;
-    }
-    if (flags3.paint) {
-      paint = handle->r8();
-    }
+void FrameImportant::load(Handle &handle) {
+  count = handle.r16();
+  bits.assign((count + 63) / 64, 0);
+  for (int i = 0; i < count; i += 8) {
+    bits[i >> 6] |= static_cast<uint64_t>(handle.r8()) << (i & 63);
   }
+}
 
-  if (flags1.wall) {
-    wall = handle->r8();
-    // 16-bit wall is set below
-    if (flags3.wallPaint) {
-      wallPaint = handle->r8();
+// Everything a flag byte tells us, worked out once for all 256 values,
+// so decoding a record is a few table lookups instead of a chain of bit tests.
+struct Flags1Info {
+  uint16_t is;
+  uint8_t rle;  // 0, 1 = 8-bit count, 2 = 16-bit count
+  uint8_t typeLength;
+  bool flags2, active, tile16, wall, liquid;
+};
+struct Flags2Info {
+  uint16_t is;
+  uint8_t slope;
+  bool flags3;
+};
+struct Flags3Info {
+  uint16_t is;
+  uint16_t shimmer;  // only applies if there's liquid
+  bool flags4, paint, wallPaint, wall16;
+};
+
+static std::array<Flags1Info, 256> makeFlags1() {
+  std::array<Flags1Info, 256> table;
+  for (int i = 0; i < 256; i++) {
+    TileFlags1 flags = std::bit_cast<TileFlags1>(static_cast<uint8_t>(i));
+    auto &info = table[i];
+    info.is = flags.active ? IsActive : IsAir;
+    if (flags.water && flags.lava) {
+      info.is |= IsHoney;
+    } else if (flags.lava) {
+      info.is |= IsLava;
     }
-    wallu = wallv = -1;
+    info.rle = flags.rle == 3 ? 0 : flags.rle;
+    info.flags2 = flags.hasFlags2;
+    info.active = flags.active;
+    info.tile16 = flags.tile16;
+    info.typeLength = flags.active ? 1 + flags.tile16 : 0;
+    info.wall = flags.wall;
+    info.liquid = flags.water || flags.lava;
   }
+  return table;
+}
 
-  if (flags1.water || flags1.lava) {
-    liquid = handle->r8();
-    if (flags1.water && flags1.lava) {
-      is |= IsHoney;
-    } else if (flags1.lava) {
-      is |= IsLava;
-    }
-    if (flags3.shimmer) {
-      is |= IsShimmer;
-    }
+static std::array<Flags2Info, 256> makeFlags2() {
+  std::array<Flags2Info, 256> table;
+  for (int i = 0; i < 256; i++) {
+    TileFlags2 flags = std::bit_cast<TileFlags2>(static_cast<uint8_t>(i));
+    auto &info = table[i];
+    info.is = (flags.redWire ? IsRedWire : IsAir) |
+      (flags.blueWire ? IsBlueWire : IsAir) |
+      (flags.greenWire ? IsGreenWire : IsAir) |
+      (flags.slope == 1 ? IsHalf : IsAir);
+    info.slope = flags.slope > 1 ? flags.slope - 1 : 0;
+    info.flags3 = flags.hasFlags3;
   }
+  return table;
+}
 
-  if (flags2.redWire) {
-    is |= IsRedWire;
-  }
-  if (flags2.blueWire) {
-    is |= IsBlueWire;
-  }
-  if (flags2.greenWire) {
-    is |= IsGreenWire;
+static std::array<Flags3Info, 256> makeFlags3() {
+  std::array<Flags3Info, 256> table;
+  for (int i = 0; i < 256; i++) {
+    TileFlags3 flags = std::bit_cast<TileFlags3>(static_cast<uint8_t>(i));
+    auto &info = table[i];
+    info.is = (flags.yellowWire ? IsYellowWire : IsAir) |
+      (flags.actuator ? IsActuator : IsAir) |
+      (flags.inactive ? IsInactive : IsAir);
+    info.shimmer = flags.shimmer ? IsShimmer : IsAir;
+    info.flags4 = flags.hasFlags4;
+    info.paint = flags.paint;
+    info.wallPaint = flags.wallPaint;
+    info.wall16 = flags.wall16;
   }
-  if (flags3.yellowWire) {
-    is |= IsYellowWire;
+  return table;
+}
+
+static const std::array<Flags1Info, 256> flags1Table = makeFlags1();
+static const std::array<Flags2Info, 256> flags2Table = makeFlags2();
+static const std::array<Flags3Info, 256> flags3Table = makeFlags3();
+
+int Tile::load(Handle &handle, const FrameImportant &extra) {
+  const uint8_t *p = handle.cursor();
+  int rle;
+  if (handle.remaining() >= MaxRecord) {
+    rle = decode(p, extra);
+  } else {
+    // close to the end of the file, decode from a padded copy so we never read past it
+    uint8_t record[MaxRecord] = {};
+    memcpy(record, p, handle.remaining());
+    const uint8_t *r = record;
+    rle = decode(r, extra);
+    p += r - record;
   }
-  if (flags2.slope > 1) {
-    slope = flags2.slope - 1;
-  } else if (flags2.slope == 1) {
-    is |= IsHalf;
+  handle.advance(p);
+  if (rle < 0) {
+    handle.fail("unknown tile type " + std::to_string(type));
   }
+  return rle;
+}
 
-  if (flags3.actuator) {
-    is |= IsActuator;
+int Tile::skip(Handle &handle, const FrameImportant &extra) {
+  const uint8_t *p = handle.cursor();
+  int type, rle;
+  if (handle.remaining() >= MaxRecord) {
+    rle = skipRecord(p, extra, type);
+  } else {
+    uint8_t record[MaxRecord] = {};
+    memcpy(record, p, handle.remaining());
+    const uint8_t *r = record;
+    rle = skipRecord(r, extra, type);
+    p += r - record;
   }
-  if (flags3.inactive) {
-    is |= IsInactive;
+  handle.advance(p);
+  if (rle < 0) {
+    handle.fail("unknown tile type " + std::to_string(type));
   }
-  if (flags3.wall16) {
-    // has to be after liquid since we read a byte
-    wall |= handle->r8() << 8;
+  return rle;
+}
+
+// Fields that aren't present are still read, then thrown away, so the
+// compiler can use conditional moves instead of unpredictable branches.
+// That's safe because the caller guarantees MaxRecord readable bytes.
+
+// returns the rle, or -1 for an unknown tile type
+int Tile::decode(const uint8_t *&p, const FrameImportant &extra) {
+  const auto &flags1 = flags1Table[p[0]];
+  uint8_t next = p[1];
+  p += 1 + flags1.flags2;
+  const auto &flags2 = flags2Table[flags1.flags2 ? next : 0];
+  next = p[0];
+  p += flags2.flags3;
+  const auto &flags3 = flags3Table[flags2.flags3 ? next : 0];
+  p += flags3.flags4;  // nothing we need in flags4
+
+  is = flags1.is | flags2.is | flags3.is | (flags1.liquid ? flags3.shimmer : 0);
+  slope = flags2.slope;
+
+  int t = flags1.active ? p[0] | (flags1.tile16 ? p[1] << 8 : 0) : 0;
+  if (t >= extra.size()) {
+    type = t;
+    return -1;
   }
+  type = t;
+  p += flags1.typeLength;
+  bool framed = flags1.active && extra[t];
+  int16_t uv = flags1.active ? -1 : 0;
+  u = framed ? p[0] | (p[1] << 8) : uv;
+  v = framed ? p[2] | (p[3] << 8) : uv;
+  p += framed ? 4 : 0;
+  bool painted = flags1.active && flags3.paint;
+  paint = painted ? p[0] : 0;
+  p += painted;
+
+  wall = flags1.wall ? p[0] : 0;
+  p += flags1.wall;
+  bool wallPainted = flags1.wall && flags3.wallPaint;
+  wallPaint = wallPainted ? p[0] : 0;
+  p += wallPainted;
+  wallu = wallv = flags1.wall ? -1 : 0;
+
+  liquid = flags1.liquid ? p[0] : 0;
+  p += flags1.liquid;
+
+  // 16-bit wall comes after liquid
+  wall |= flags3.wall16 ? p[0] << 8 : 0;
+  p += flags3.wall16;
+
+  // rle is 0, 1 or 2 bytes long
+  int rle = flags1.rle == 2 ? p[0] | (p[1] << 8) : flags1.rle == 1 ? p[0] : 0;
+  p += flags1.rle;
+  return rle;
+}
 
-  switch (flags1.rle) {
-    case 1:
-      return handle->r8();
-    case 2:
-      return handle->r16();
+// must consume exactly the same bytes as decode()
+int Tile::skipRecord(const uint8_t *&p, const FrameImportant &extra, int &type) {
+  const auto &flags1 = flags1Table[p[0]];
+  uint8_t next = p[1];
+  p += 1 + flags1.flags2;
+  const auto &flags2 = flags2Table[flags1.flags2 ? next : 0];
+  next = p[0];
+  p += flags2.flags3;
+  const auto &flags3 = flags3Table[flags2.flags3 ? next : 0];
+  p += flags3.flags4;
+
+  type = flags1.active ? p[0] | (flags1.tile16 ? p[1] << 8 : 0) : 0;
+  if (type >= extra.size()) {
+    return -1;
   }
-  return 0;
+  p += flags1.typeLength;
+  p += flags1.active ? (extra[type] ? 4 : 0) + flags3.paint : 0;
+  p += flags1.wall ? 1 + flags3.wallPaint : 0;
+  p += flags1.liquid + flags3.wall16;
+
+  int rle = flags1.rle == 2 ? p[0] | (p[1] << 8) : flags1.rle == 1 ? p[0] : 0;
+  p += flags1.rle;
+  return rle;
 }
 
 void Tile::setSeen(bool seen) {
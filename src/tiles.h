@@ -142,11 +142,33 @@ struct TileFlags4 {
   bool glowingWall : 1;  // 10
 };
 
+// Which tile types store their u/v in the world file.
+// Kept as a flat bitset since it's checked for every active tile.
+class FrameImportant {
+  public:
+    void load(Handle &handle);
+    int size() const {
+      return count;
+    }
+    bool operator[](int type) const {
+      return (bits[type >> 6] >> (type & 63)) & 1;
+    }
+
+  private:
+    std::vector<uint64_t> bits;
+    int count = 0;
+};
+
 class Tile {
   public:
+    // largest possible tile record: 4 flags, type, uv, paint, wall, wall paint, liquid, wall high byte, rle
+    static const int MaxRecord = 4 + 2 + 4 + 1 + 1 + 1 + 1 + 1 + 2;
+
     int16_t u, v, wallu, wallv, type, wall;
     uint8_t liquid, paint, wallPaint, slope;
-    int load(std::shared_ptr<Handle> handle, const std::vector<bool> &extra);
+    int load(Handle &handle, const FrameImportant &extra);
+    // steps over a record without decoding it, returns the rle
+    static int skip(Handle &handle, const FrameImportant &extra);
     uint16_t Is() const;
     bool active() const;
     bool lava() const;
@@ -159,5 +181,8 @@ class Tile {
     bool inactive() const;
 
   private:
+    friend class TileStore;
+    int decode(const uint8_t *&p, const FrameImportant &extra);
+    static int skipRecord(const uint8_t *&p, const FrameImportant &extra, int &type);
     uint16_t is;
 };
@@ -0,0 +1,222 @@
+/** @copyright 2025 Sean Kasun */
+
+#include "tilestore.h"
+#include <cstring>
+
+template <typename T>
+static std::unique_ptr<T[]> plane(size_t count) {
+  return std::unique_ptr<T[]>(new T[count]());  // () = init to zero
+}
+
+static const int ChunkCells = TileStore::ChunkSize * TileStore::ChunkSize;
+
+void TileStore::resize(int width, int height, bool chunked) {
+  count = static_cast<size_t>(width) * height;
+  this->width = width;
+  this->chunked = chunked;
+  chunks.clear();
+  if (chunked) {
+    chunksWide = (width + ChunkSize - 1) / ChunkSize;
+    int chunksHigh = (height + ChunkSize - 1) / ChunkSize;
+    Chunk empty;
+    empty.palette.push_back(Cell {});
+    chunks.assign(static_cast<size_t>(chunksWide) * chunksHigh, empty);
+    flags.reset();
+    types.reset();
+    walls.reset();
+    us.reset();
+    vs.reset();
+    liquids.reset();
+    paints.reset();
+    wallPaints.reset();
+    slopes.reset();
+    wallFrames.reset();
+    return;
+  }
+  flags = plane<uint16_t>(count);
+  types = plane<int16_t>(count);
+  walls = plane<int16_t>(count);
+  us = plane<int16_t>(count);
+  vs = plane<int16_t>(count);
+  liquids = plane<uint8_t>(count);
+  paints = plane<uint8_t>(count);
+  wallPaints = plane<uint8_t>(count);
+  slopes = plane<uint8_t>(count);
+  wallFrames = plane<uint8_t>(count);
+}
+
+size_t TileStore::bytes() const {
+  if (!chunked) {
+    return count * (sizeof(uint16_t) + sizeof(int16_t) * 4 + sizeof(uint8_t) * 5);
+  }
+  size_t total = chunks.capacity() * sizeof(Chunk);
+  for (const auto &chunk : chunks) {
+    total += chunk.palette.capacity() * sizeof(Cell) + chunk.indices.capacity() * sizeof(uint64_t);
+  }
+  return total;
+}
+
+void TileStore::set(int offset, const Tile &tile) {
+  if (chunked) {
+    put(offset, pack(tile));
+    return;
+  }
+  flags[offset] = tile.Is();
+  types[offset] = tile.type;
+  walls[offset] = tile.wall;
+  us[offset] = tile.u;
+  vs[offset] = tile.v;
+  liquids[offset] = tile.liquid;
+  paints[offset] = tile.paint;
+  wallPaints[offset] = tile.wallPaint;
+  slopes[offset] = tile.slope;
+  wallFrames[offset] = frame(tile.wallu, tile.wallv);
+}
+
+void TileStore::setUV(int offset, int16_t u, int16_t v) {
+  if (chunked) {
+    Cell c = cell(offset);
+    c.u = u;
+    c.v = v;
+    put(offset, c);
+    return;
+  }
+  us[offset] = u;
+  vs[offset] = v;
+}
+
+void TileStore::setWallUV(int offset, int16_t u, int16_t v) {
+  if (chunked) {
+    Cell c = cell(offset);
+    c.wallFrame = frame(u, v);
+    put(offset, c);
+    return;
+  }
+  wallFrames[offset] = frame(u, v);
+}
+
+TileStore::Cell TileStore::pack(const Tile &tile) {
+  Cell cell {};
+  cell.flags = tile.Is();
+  cell.type = tile.type;
+  cell.wall = tile.wall;
+  cell.u = tile.u;
+  cell.v = tile.v;
+  cell.liquid = tile.liquid;
+  cell.paint = tile.paint;
+  cell.wallPaint = tile.wallPaint;
+  cell.slope = tile.slope;
+  cell.wallFrame = frame(tile.wallu, tile.wallv);
+  return cell;
+}
+
+Tile TileStore::unpack(const Cell &cell) {
+  Tile tile;
+  tile.u = cell.u;
+  tile.v = cell.v;
+  tile.wallu = cell.wallFrame == NoFrame ? -1 : (cell.wallFrame & 0xf) * 36;
+  tile.wallv = cell.wallFrame == NoFrame ? -1 : (cell.wallFrame >> 4) * 36;
+  tile.type = cell.type;
+  tile.wall = cell.wall;
+  tile.liquid = cell.liquid;
+  tile.paint = cell.paint;
+  tile.wallPaint = cell.wallPaint;
+  tile.slope = cell.slope;
+  tile.is = cell.flags;
+  return tile;
+}
+
+void TileStore::put(int offset, const Cell &cell) {
+  int y = offset / width;
+  int x = offset - y * width;
+  chunks[(y / ChunkSize) * chunksWide + x / ChunkSize].put((y % ChunkSize) * ChunkSize + x % ChunkSize, cell);
+}
+
+static int entryAt(const std::vector<uint64_t> &indices, int bits, int index) {
+  if (bits == 0) {
+    return 0;
+  }
+  int bit = index * bits;
+  return (indices[bit >> 6] >> (bit & 63)) & ((1 << bits) - 1);
+}
+
+static void storeAt(std::vector<uint64_t> &indices, int bits, int index, int entry) {
+  int bit = index * bits;
+  uint64_t mask = ((1ull << bits) - 1) << (bit & 63);
+  indices[bit >> 6] = (indices[bit >> 6] & ~mask) | (static_cast<uint64_t>(entry) << (bit & 63));
+}
+
+int TileStore::Chunk::find(const Cell &cell) {
+  if (memcmp(&palette[last], &cell, sizeof(Cell)) == 0) {
+    return last;
+  }
+  for (size_t i = 0; i < palette.size(); i++) {
+    if (memcmp(&palette[i], &cell, sizeof(Cell)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void TileStore::Chunk::put(int index, const Cell &cell) {
+  if (bits == Direct) {
+    palette[index] = cell;
+    return;
+  }
+  int entry = find(cell);
+  if (entry < 0) {
+    if (palette.size() == 1u << bits) {
+      repack();
+      if (bits == Direct) {
+        palette[index] = cell;
+        return;
+      }
+    }
+    entry = palette.size();
+    palette.push_back(cell);
+  }
+  if (bits) {
+    storeAt(indices, bits, index, entry);
+  }
+  last = entry;
+}
+
+// The palette is full.  Drop entries nothing points at any more (lazily
+// mapped u/vs leave the unmapped tile behind), then widen the indices if
+// that didn't free up room for one more.
+void TileStore::Chunk::repack() {
+  int oldBits = bits;
+  std::vector<int> remap(palette.size(), -1);
+  std::vector<Cell> used;
+  for (int i = 0; i < ChunkCells; i++) {
+    int entry = entryAt(indices, oldBits, i);
+    if (remap[entry] < 0) {
+      remap[entry] = used.size();
+      used.push_back(palette[entry]);
+    }
+  }
+  int newBits = oldBits ? oldBits : 1;
+  while ((1u << newBits) < used.size() + 1) {
+    newBits *= 2;
+  }
+  if (newBits > 8) {
+    std::vector<Cell> cells(ChunkCells);
+    for (int i = 0; i < ChunkCells; i++) {
+      cells[i] = palette[entryAt(indices, oldBits, i)];
+    }
+    palette = std::move(cells);
+    indices.clear();
+    indices.shrink_to_fit();
+    bits = Direct;
+    last = 0;
+    return;
+  }
+  std::vector<uint64_t> packed(ChunkCells * newBits / 64);
+  for (int i = 0; i < ChunkCells; i++) {
+    storeAt(packed, newBits, i, remap[entryAt(indices, oldBits, i)]);
+  }
+  palette = std::move(used);
+  indices = std::move(packed);
+  bits = newBits;
+  last = 0;
+}
@@ -0,0 +1,168 @@
+/** @copyright 2025 Sean Kasun */
+
+#pragma once
+
+#include "tiles.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// The world's tiles, stored as separate planes so code that only needs a
+// couple of fields (liquids, neighbor checks) only pulls those through the
+// cache.  operator[] gathers a whole Tile; after inlining, the compiler
+// only loads the planes that are actually used.
+//
+// Worlds too big for planes are stored chunked instead: 32x32 chunks, each
+// with a palette of the distinct tiles in it and bit-packed indices into
+// that palette.  Most chunks are solid stone or empty sky and need only
+// a single palette entry.
+//
+// Only the loader writes, and only to columns that haven't landed yet, so
+// the renderer never reads a chunk while it's being put or repacked.
+class TileStore {
+  public:
+    static const int ChunkSize = 32;
+
+    // different chunks may be written from different threads, the same
+    // chunk may not.
+    void resize(int width, int height, bool chunked);
+    size_t bytes() const;
+    bool isChunked() const {
+      return chunked;
+    }
+
+    Tile operator[](int offset) const {
+      if (chunked) {
+        return unpack(cell(offset));
+      }
+      Tile tile;
+      tile.u = us[offset];
+      tile.v = vs[offset];
+      tile.wallu = wallu(offset);
+      tile.wallv = wallv(offset);
+      tile.type = types[offset];
+      tile.wall = walls[offset];
+      tile.liquid = liquids[offset];
+      tile.paint = paints[offset];
+      tile.wallPaint = wallPaints[offset];
+      tile.slope = slopes[offset];
+      tile.is = flags[offset];
+      return tile;
+    }
+    void set(int offset, const Tile &tile);
+
+    uint16_t is(int offset) const {
+      return chunked ? cell(offset).flags : flags[offset];
+    }
+    bool active(int offset) const {
+      return is(offset) & IsActive;
+    }
+    bool half(int offset) const {
+      return is(offset) & IsHalf;
+    }
+    bool lava(int offset) const {
+      return is(offset) & IsLava;
+    }
+    bool honey(int offset) const {
+      return is(offset) & IsHoney;
+    }
+    bool shimmer(int offset) const {
+      return is(offset) & IsShimmer;
+    }
+    bool actuator(int offset) const {
+      return is(offset) & IsActuator;
+    }
+    bool inactive(int offset) const {
+      return is(offset) & IsInactive;
+    }
+    int16_t type(int offset) const {
+      return chunked ? cell(offset).type : types[offset];
+    }
+    int16_t wall(int offset) const {
+      return chunked ? cell(offset).wall : walls[offset];
+    }
+    int16_t u(int offset) const {
+      return chunked ? cell(offset).u : us[offset];
+    }
+    int16_t v(int offset) const {
+      return chunked ? cell(offset).v : vs[offset];
+    }
+    // wall frames are on a 36 pixel grid, so we pack them into a byte
+    int16_t wallu(int offset) const {
+      uint8_t f = chunked ? cell(offset).wallFrame : wallFrames[offset];
+      return f == NoFrame ? -1 : (f & 0xf) * 36;
+    }
+    int16_t wallv(int offset) const {
+      uint8_t f = chunked ? cell(offset).wallFrame : wallFrames[offset];
+      return f == NoFrame ? -1 : (f >> 4) * 36;
+    }
+    uint8_t liquid(int offset) const {
+      return chunked ? cell(offset).liquid : liquids[offset];
+    }
+    uint8_t paint(int offset) const {
+      return chunked ? cell(offset).paint : paints[offset];
+    }
+    uint8_t wallPaint(int offset) const {
+      return chunked ? cell(offset).wallPaint : wallPaints[offset];
+    }
+    uint8_t slope(int offset) const {
+      return chunked ? cell(offset).slope : slopes[offset];
+    }
+
+    void setUV(int offset, int16_t u, int16_t v);
+    void setWallUV(int offset, int16_t u, int16_t v);
+
+  private:
+    static const uint8_t NoFrame = 0xff;
+    static uint8_t frame(int16_t u, int16_t v) {
+      return u < 0 ? NoFrame : (u / 36) | ((v / 36) << 4);
+    }
+
+    // a whole tile, packed into 16 bytes so palette lookups are two compares
+    struct Cell {
+      uint16_t flags;
+      int16_t type, wall, u, v;
+      uint8_t liquid, paint, wallPaint, slope, wallFrame, pad;
+    };
+    static Cell pack(const Tile &tile);
+    static Tile unpack(const Cell &cell);
+
+    // bits is 0 for a uniform chunk, then 1, 2, 4 or 8.  Chunks with more
+    // than 256 distinct tiles stop using a palette and store cells directly.
+    struct Chunk {
+      std::vector<Cell> palette;
+      std::vector<uint64_t> indices;
+      int bits = 0;
+      int last = 0;  // rle runs write the same tile over and over
+      int find(const Cell &cell);
+      void put(int index, const Cell &cell);
+      void repack();
+    };
+    static const int Direct = 16;
+
+    const Cell &cell(int offset) const {
+      int y = offset / width;
+      int x = offset - y * width;
+      const Chunk &chunk = chunks[(y / ChunkSize) * chunksWide + x / ChunkSize];
+      int index = (y % ChunkSize) * ChunkSize + x % ChunkSize;
+      if (chunk.bits == 0) {
+        return chunk.palette[0];
+      }
+      if (chunk.bits == Direct) {
+        return chunk.palette[index];
+      }
+      int bit = index * chunk.bits;
+      int entry = (chunk.indices[bit >> 6] >> (bit & 63)) & ((1 << chunk.bits) - 1);
+      return chunk.palette[entry];
+    }
+    void put(int offset, const Cell &cell);
+
+    size_t count = 0;
+    bool chunked = false;
+    int width = 0, chunksWide = 0;
+    std::vector<Chunk> chunks;
+    std::unique_ptr<uint16_t[]> flags;
+    std::unique_ptr<int16_t[]> types, walls, us, vs;
+    std::unique_ptr<uint8_t[]> liquids, paints, wallPaints, slopes, wallFrames;
+};
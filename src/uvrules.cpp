@@ -3,7 +3,7 @@
 #include "uvrules.h"
 #include "tiles.h"
 #include "world.h"
-#include <cstdlib>
+#include <vector>
 
 // rules for setting uvs various types of blocks based on surrounding tiles
 
@@ -211,87 +211,99 @@ static const int walluvs[][8] = {
   {396,   0, 396,  36, 396,  72, 396, 180}
 };
 
-uint8_t UVRules::mapTile(const World &world, int x, int y) {
-  int t = -1, l = -1, r = -1, b = -1;
-  int tl = -1, tr = -1, bl = -1, br = -1;
+// The variant to use for a tile.  It's a hash of the position rather than
+// rand(), so every thread (and every redraw) picks the same one.
+static int variant(int x, int y) {
+  uint32_t h = static_cast<uint32_t>(x) * 0x9e3779b1u ^ static_cast<uint32_t>(y) * 0x85ebca77u;
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  return h % 3;
+}
+
+// slopes, as bits, that face away from a neighbor on a given side
+static const int SlopesAwayDown = (1 << 3) | (1 << 4);
+static const int SlopesAwayUp = (1 << 1) | (1 << 2);
+static const int SlopesAwayRight = (1 << 1) | (1 << 3);
+static const int SlopesAwayLeft = (1 << 2) | (1 << 4);
+
+// A neighbor as the rules see it: air if there's nothing there or it slopes
+// away from us, and every stone-like tile is just stone.
+static int kind(const World &world, int offset, int slopes) {
+  const auto &tiles = world.tiles;
+  if (!tiles.active(offset) || ((slopes >> tiles.slope(offset)) & 1)) {
+    return TileAir;
+  }
+  int16_t type = tiles.type(offset);
+  return world.info.stone(type) ? static_cast<int>(TileStone) : type;
+}
+
+// The first rule in a table that matches a mask, for every possible mask,
+// so picking a rule is a single lookup instead of a scan.
+template <size_t N>
+class RuleTable {
+  public:
+    explicit RuleTable(const UVRule (&rules)[N], int bits = 16) : rules(rules), first(1 << bits, NoRule) {
+      static_assert(N < NoRule);
+      for (size_t mask = 0; mask < first.size(); mask++) {
+        for (size_t i = 0; i < N; i++) {
+          if ((mask & rules[i].mask) == rules[i].val) {
+            first[mask] = i;
+            break;
+          }
+        }
+      }
+    }
+    const UVRule *operator[](int mask) const {
+      uint8_t i = first[mask];
+      return i == NoRule ? nullptr : &rules[i];
+    }
+
+  private:
+    static const uint8_t NoRule = 0xff;
+    const UVRule *rules;
+    std::vector<uint8_t> first;
+};
+
+static const RuleTable grassTable(grassRules);
+static const RuleTable blendTable(blendRules);
+static const RuleTable noGrassTable(noGrassRules);
+static const RuleTable uvTable(uvRules);
+static const RuleTable cactusTable(cactusRules, 10);
+
+uint8_t UVRules::tileUV(const World &world, int x, int y, int16_t &u, int16_t &v) {
+  const auto &tiles = world.tiles;
 
   int stride = world.tilesWide;
   int offset = y * stride + x;
+  u = tiles.u(offset);
+  v = tiles.v(offset);
 
-  const auto &tile = world.tiles[offset];
-  int16_t c = tile.type;
-  if (world.info[c]->stone) {
+  int16_t c = tiles.type(offset);
+  if (world.info.stone(c)) {
     c = TileStone;
   }
 
   if (c == TileCactus) {
-    mapCactus(world, x, y);
+    cactusUV(world, x, y, u, v);
     return 0;
   }
+  const auto &info = *world.info[c];
 
-  if (x > 0) {
-    const auto &left = world.tiles[offset - 1];
-    if (left.active() && left.slope != 1 && left.slope != 3) {
-      l = left.type;
-      if (world.info[l]->stone) {
-        l = TileStone;
-      }
-    }
-    if (y > 0 && world.tiles[offset - stride - 1].active()) {
-      tl = world.tiles[offset - stride - 1].type;
-      if (world.info[tl]->stone) {
-        tl = TileStone;
-      }
-    }
-    if (y < world.tilesHigh - 1 && world.tiles[offset + stride - 1].active()) {
-      bl = world.tiles[offset + stride - 1].type;
-      if (world.info[bl]->stone) {
-        bl = TileStone;
-      }
-    }
-  }
-  if (x < world.tilesWide - 1) {
-    const auto &right = world.tiles[offset + 1];
-    if (right.active() && right.slope != 2 && right.slope != 4) {
-      r = right.type;
-      if (world.info[r]->stone) {
-        r = TileStone;
-      }
-    }
-    if (y > 0 && world.tiles[offset - stride + 1].active()) {
-      tr = world.tiles[offset - stride + 1].type;
-      if (world.info[tr]->stone) {
-        tr = TileStone;
-      }
-    }
-    if (y < world.tilesHigh - 1 && world.tiles[offset + stride + 1].active()) {
-      br = world.tiles[offset + stride + 1].type;
-      if (world.info[br]->stone) {
-        br = TileStone;
-      }
-    }
-  }
-  if (y > 0) {
-    const auto &top = world.tiles[offset - stride];
-    if (top.active() && top.slope != 3 && top.slope != 4) {
-      t = top.type;
-      if (world.info[t]->stone) {
-        t = TileStone;
-      }
-    }
-  }
-  if (y < world.tilesHigh - 1) {
-    const auto &bottom = world.tiles[offset + stride];
-    if (bottom.active() && bottom.slope != 1 && bottom.slope != 2) {
-      b = bottom.type;
-      if (world.info[b]->stone) {
-        b = TileStone;
-      }
-    }
-  }
+  // off the edge of the world is air, and so is anything sloped away from us
+  bool hasL = x > 0, hasR = x < world.tilesWide - 1;
+  bool hasT = y > 0, hasB = y < world.tilesHigh - 1;
+  int t = hasT ? kind(world, offset - stride, SlopesAwayDown) : TileAir;
+  int b = hasB ? kind(world, offset + stride, SlopesAwayUp) : TileAir;
+  int l = hasL ? kind(world, offset - 1, SlopesAwayRight) : TileAir;
+  int r = hasR ? kind(world, offset + 1, SlopesAwayLeft) : TileAir;
+  int tl = hasT && hasL ? kind(world, offset - stride - 1, 0) : TileAir;
+  int tr = hasT && hasR ? kind(world, offset - stride + 1, 0) : TileAir;
+  int bl = hasB && hasL ? kind(world, offset + stride - 1, 0) : TileAir;
+  int br = hasB && hasR ? kind(world, offset + stride + 1, 0) : TileAir;
 
   // fix slopes
-  switch (tile.slope) {
+  switch (tiles.slope(offset)) {
     case 1:
       t = r = TileAir;
       break;
@@ -307,7 +319,8 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
   }
 
   // check blends and merges
-  for (const auto &blend : world.info[c]->blends) {
+  int16_t nu, nv;  // recursive checks only need the neighbor's blend
+  for (const auto &blend : info.blends) {
     uint8_t dir = 0;
     if (blend.hasTile) {
       dir |= t == blend.tile ? 8 : 0;
@@ -331,16 +344,16 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
     dir &= blend.direction;
     int target = blend.blend ? TileBlend : c;
 
-    if ((dir & 8) && (!blend.recursive || (mapTile(world, x, y - 1) & 4))) {
+    if ((dir & 8) && (!blend.recursive || (tileUV(world, x, y - 1, nu, nv) & 4))) {
       t = target;
     }
-    if ((dir & 4) && (!blend.recursive || (mapTile(world, x, y + 1) & 8))) {
+    if ((dir & 4) && (!blend.recursive || (tileUV(world, x, y + 1, nu, nv) & 8))) {
       b = target;
     }
-    if ((dir & 2) && (!blend.recursive || (mapTile(world, x - 1, y) & 1))) {
+    if ((dir & 2) && (!blend.recursive || (tileUV(world, x - 1, y, nu, nv) & 1))) {
       l = target;
     }
-    if ((dir & 1) && (!blend.recursive || (mapTile(world, x + 1, y) & 2))) {
+    if ((dir & 1) && (!blend.recursive || (tileUV(world, x + 1, y, nu, nv) & 2))) {
       r = target;
     }
     if (dir & 0x80) {
@@ -357,7 +370,7 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
     }
   }
 
-  if (world.info[c]->brick) {
+  if (info.brick) {
     if (t > TileAir && world.info[t]->brick) {
       t = c;
     }
@@ -384,7 +397,7 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
     }
   }
 
-  if (world.info[c]->pile) {
+  if (info.pile) {
     if (t > TileAir && world.info[t]->pile) {
       t = c;
     }
@@ -411,7 +424,7 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
     }
   }
 
-  if (world.info[c]->dirt) {
+  if (info.dirt) {
     if (t == TileDirt) {
       t = TileBlend;
     }
@@ -501,51 +514,51 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
   }
 
   // slope and half rules
-  if ((tile.slope == 1 || tile.slope == 2) && b > TileAir && b != TilePlatforms) {
+  if ((tiles.slope(offset) == 1 || tiles.slope(offset) == 2) && b > TileAir && b != TilePlatforms) {
     b = c;
   }
   if (t > TileAir) {
-    const auto &top = world.tiles[offset - stride];
-    if ((top.slope == 1 || top.slope == 2) && t != TilePlatforms) {
+    int top = offset - stride;
+    if ((tiles.slope(top) == 1 || tiles.slope(top) == 2) && t != TilePlatforms) {
       t = c;
     }
-    if (top.half() && t != TilePlatforms) {
+    if (tiles.half(top) && t != TilePlatforms) {
       t = c;
     }
   }
-  if ((tile.slope == 3 || tile.slope == 4) && t > TileAir && t != TilePlatforms) {
+  if ((tiles.slope(offset) == 3 || tiles.slope(offset) == 4) && t > TileAir && t != TilePlatforms) {
     t = c;
   }
   if (b > TileAir) {
-    const auto &bottom = world.tiles[offset + stride];
-    if ((bottom.slope == 3 || bottom.slope == 4) && b != TilePlatforms) {
+    int bottom = offset + stride;
+    if ((tiles.slope(bottom) == 3 || tiles.slope(bottom) == 4) && b != TilePlatforms) {
       b = c;
-      if (bottom.half()) {
+      if (tiles.half(bottom)) {
         b = TileAir;
       }
     }
   }
   if (l > TileAir) {
-    const auto &left = world.tiles[offset - 1];
-    if (left.half()) {
-      if (tile.half()) {
+    int left = offset - 1;
+    if (tiles.half(left)) {
+      if (tiles.half(offset)) {
         l = c;
-      } else if (left.type != c) {
+      } else if (tiles.type(left) != c) {
         l = TileAir;
       }
     }
   }
   if (r > TileAir) {
-    const auto &right = world.tiles[offset + 1];
-    if (right.half()) {
-      if (tile.half()) {
+    int right = offset + 1;
+    if (tiles.half(right)) {
+      if (tiles.half(offset)) {
         r = c;
-      } else if (right.type != c) {
+      } else if (tiles.type(right) != c) {
         r = TileAir;
       }
     }
   }
-  if (tile.half()) {
+  if (tiles.half(offset)) {
     if (l != c) {
       l = TileAir;
     }
@@ -557,20 +570,20 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
 
   int blend = 0;
   // fix paint mismatches
-  if (!world.info[c]->grass) {
-    if (t == TileBlend && tile.paint != world.tiles[offset - stride].paint) {
+  if (!info.grass) {
+    if (t == TileBlend && tiles.paint(offset) != tiles.paint(offset - stride)) {
       blend |= 8;
       t = c;
     }
-    if (b == TileBlend && tile.paint != world.tiles[offset + stride].paint) {
+    if (b == TileBlend && tiles.paint(offset) != tiles.paint(offset + stride)) {
       blend |= 4;
       b = c;
     }
-    if (l == TileBlend && tile.paint != world.tiles[offset - 1].paint) {
+    if (l == TileBlend && tiles.paint(offset) != tiles.paint(offset - 1)) {
       blend |= 2;
       l = c;
     }
-    if (r == TileBlend && tile.paint != world.tiles[offset + 1].paint) {
+    if (r == TileBlend && tiles.paint(offset) != tiles.paint(offset + 1)) {
       blend |= 1;
       r = c;
     }
@@ -586,81 +599,59 @@ uint8_t UVRules::mapTile(const World &world, int x, int y) {
   mask |= (bl == c) ? 0x0c00 : (bl == TileBlend) ? 0x0800 : 0;
   mask |= (br == c) ? 0x0300 : (br == TileBlend) ? 0x0200 : 0;
 
-  int set = (rand() % 3) * 2;
-  if (world.info[c]->large) {
+  int set = variant(x, y) * 2;
+  if (info.large) {
     set = (phlebasTiles[y % 4][x % 3] - 1) * 2;
   }
 
-  if (world.info[c]->grass) {
-    for (const auto &rule : grassRules) {
-      if ((mask & rule.mask) == rule.val) {
-        world.tiles[offset].u = rule.uvs[set];
-        world.tiles[offset].v = rule.uvs[set + 1];
-        return rule.blend | blend;
-      }
+  if (info.grass) {
+    if (const UVRule *rule = grassTable[mask]) {
+      u = rule->uvs[set];
+      v = rule->uvs[set + 1];
+      return rule->blend | blend;
     }
   }
-
-  if (world.info[c]->merge || world.info[c]->dirt) {
-    for (const auto &rule : blendRules) {
-      if ((mask & rule.mask) == rule.val) {
-        world.tiles[offset].u = rule.uvs[set];
-        world.tiles[offset].v = rule.uvs[set + 1];
-        if (world.info[c]->large && set == 6) {
-          world.tiles[offset].v += 90;
-        }
-        return rule.blend | blend;
-      }
-    }
-    if (!world.info[c]->grass) {
-      for (const auto &rule : noGrassRules) {
-        if ((mask & rule.mask) == rule.val) {
-          world.tiles[offset].u = rule.uvs[set];
-          world.tiles[offset].v = rule.uvs[set + 1];
-          if (world.info[c]->large && set == 6) {
-            world.tiles[offset].v += 90;
-          }
-          return rule.blend | blend;
-        }
-      }
+  const UVRule *rule = nullptr;
+  if (info.merge || info.dirt) {
+    rule = blendTable[mask];
+    if (!rule && !info.grass) {
+      rule = noGrassTable[mask];
     }
   }
-  // no match, blends become merges
-  if (world.info[c]->grass) {
-    mask |= (mask & 0xaaaa) >> 1;
-  }
-
-  for (const auto &rule : uvRules) {
-    if ((mask & rule.mask) == rule.val) {
-      world.tiles[offset].u = rule.uvs[set];
-      world.tiles[offset].v = rule.uvs[set + 1];
-      if (world.info[c]->large && set == 6) {
-        world.tiles[offset].v += 90;
-      }
-      return rule.blend | blend;
+  if (!rule) {
+    // no match, blends become merges
+    if (info.grass) {
+      mask |= (mask & 0xaaaa) >> 1;
     }
+    // uvRules ends with a catch-all, so this always matches
+    rule = uvTable[mask];
+  }
+  u = rule->uvs[set];
+  v = rule->uvs[set + 1];
+  if (info.large && set == 6) {
+    v += 90;
   }
-  // shouldn't get here since there's a catch-all rule in uvRules
-  return blend;
+  return rule->blend | blend;
 }
 
-void UVRules::mapCactus(const World &world, int x, int y) {
+void UVRules::cactusUV(const World &world, int x, int y, int16_t &u, int16_t &v) {
+  const auto &tiles = world.tiles;
   int stride = world.tilesWide;
   int offset = y * stride + x;
 
   // find base of cactus
   int basex = x;
   int base = offset;
-  while (world.tiles[base].active() && world.tiles[base].type == TileCactus) {
+  while (tiles.active(base) && tiles.type(base) == TileCactus) {
     base += stride;
-    if (!world.tiles[base].active() || world.tiles[base].type != TileCactus) {
-      if (basex >= x && world.tiles[base - 1].active() && world.tiles[base - 1].type == TileCactus &&
-          world.tiles[base - stride - 1].active() && world.tiles[base - stride - 1].type == TileCactus) {
+    if (!tiles.active(base) || tiles.type(base) != TileCactus) {
+      if (basex >= x && tiles.active(base - 1) && tiles.type(base - 1) == TileCactus &&
+          tiles.active(base - stride - 1) && tiles.type(base - stride - 1) == TileCactus) {
         basex--;
         base--;
       }
-      if (basex <= x && world.tiles[base + 1].active() && world.tiles[base + 1].type == TileCactus &&
-          world.tiles[base - stride + 1].active() && world.tiles[base - stride + 1].type == TileCactus) {
+      if (basex <= x && tiles.active(base + 1) && tiles.type(base + 1) == TileCactus &&
+          tiles.active(base - stride + 1) && tiles.type(base - stride + 1) == TileCactus) {
         basex++;
         base++;
       }
@@ -669,47 +660,47 @@ void UVRules::mapCactus(const World &world, int x, int y) {
 
   int mask = 0;
   if (x < world.tilesWide - 1) {
-    const auto &right = world.tiles[offset + 1];
-    if (right.active() && right.type == TileCactus) {
+    int right = offset + 1;
+    if (tiles.active(right) && tiles.type(right) == TileCactus) {
       mask |= 0x01;
     }
   }
   if (x > 0) {
-    const auto &left = world.tiles[offset - 1];
-    if (left.active() && left.type == TileCactus) {
+    int left = offset - 1;
+    if (tiles.active(left) && tiles.type(left) == TileCactus) {
       mask |= 0x02;
     }
     if (x > 1) {
-      const auto &fl = world.tiles[offset - 2];
-      if (fl.active() && fl.type == TileCactus) {
+      int fl = offset - 2;
+      if (tiles.active(fl) && tiles.type(fl) == TileCactus) {
         mask |= 0x40;
       }
     }
   }
   if (y < world.tilesHigh - 1) {
-    const auto &bottom = world.tiles[offset + stride];
-    if (bottom.active() && bottom.type == TileCactus) {
+    int bottom = offset + stride;
+    if (tiles.active(bottom) && tiles.type(bottom) == TileCactus) {
       mask |= 0x04;
     }
-    if (bottom.active() && world.info[bottom.type]->solid) {
+    if (tiles.active(bottom) && world.info[tiles.type(bottom)]->solid) {
       mask |= 0x80;
     }
     if (x < world.tilesWide - 1) {
-      const auto &br = world.tiles[offset + stride + 1];
-      if (br.active() && br.type == TileCactus) {
+      int br = offset + stride + 1;
+      if (tiles.active(br) && tiles.type(br) == TileCactus) {
         mask |= 0x10;
       }
     }
     if (x > 0) {
-      const auto &bl = world.tiles[offset + stride - 1];
-      if (bl.active() && bl.type == TileCactus) {
+      int bl = offset + stride - 1;
+      if (tiles.active(bl) && tiles.type(bl) == TileCactus) {
         mask |= 0x20;
       }
     }
   }
   if (y > 0) {
-    const auto &top = world.tiles[offset - stride];
-    if (top.active() && (top.type == TileCactus || top.type == TileFlower)) {
+    int top = offset - stride;
+    if (tiles.active(top) && (tiles.type(top) == TileCactus || tiles.type(top) == TileFlower)) {
       mask |= 0x08;
     }
   }
@@ -720,46 +711,44 @@ void UVRules::mapCactus(const World &world, int x, int y) {
     mask |= 0x100;
   }
 
-  for (const auto &rule : cactusRules) {
-    if ((mask & rule.mask) == rule.val) {
-      world.tiles[offset].u = rule.uvs[0];
-      world.tiles[offset].v = rule.uvs[1];
-      return;
-    }
+  if (const UVRule *rule = cactusTable[mask]) {
+    u = rule->uvs[0];
+    v = rule->uvs[1];
   }
 }
 
-void UVRules::mapWall(const class World &world, int x, int y) {
+void UVRules::wallUV(const World &world, int x, int y, int16_t &u, int16_t &v) {
+  const auto &tiles = world.tiles;
   int stride = world.tilesWide;
   int offset = y * stride + x;
   int mask = 0;
   if (y > 0) {
-    const auto &top = world.tiles[offset - stride];
-    if (top.wall || (top.active() && top.type == TileGlass)) {
+    int top = offset - stride;
+    if (tiles.wall(top) || (tiles.active(top) && tiles.type(top) == TileGlass)) {
       mask |= 1;
     }
   }
   if (x > 0) {
-    const auto &left = world.tiles[offset - 1];
-    if (left.wall || (left.active() && left.type == TileGlass)) {
+    int left = offset - 1;
+    if (tiles.wall(left) || (tiles.active(left) && tiles.type(left) == TileGlass)) {
       mask |= 2;
     }
   }
   if (x < world.tilesWide - 1) {
-    const auto &right = world.tiles[offset + 1];
-    if (right.wall || (right.active() && right.type == TileGlass)) {
+    int right = offset + 1;
+    if (tiles.wall(right) || (tiles.active(right) && tiles.type(right) == TileGlass)) {
       mask |= 4;
     }
   }
   if (y < world.tilesHigh - 1) {
-    const auto &bottom = world.tiles[offset + stride];
-    if (bottom.wall || (bottom.active() && bottom.type == TileGlass)) {
+    int bottom = offset + stride;
+    if (tiles.wall(bottom) || (tiles.active(bottom) && tiles.type(bottom) == TileGlass)) {
       mask |= 8;
     }
   }
 
-  int set = (rand() % 3) * 2;
-  int wall = world.tiles[offset].wall;
+  int set = variant(x, y) * 2;
+  int wall = tiles.wall(offset);
   switch (world.info.walls.at(wall)->large) {
     case 1:
       set = (phlebasTiles[y % 4][x % 3] - 1) * 2;
@@ -773,6 +762,6 @@ void UVRules::mapWall(const class World &world, int x, int y) {
     mask += wallRandom[x % 3][y % 3];
   }
 
-  world.tiles[offset].wallu = walluvs[mask][set];
-  world.tiles[offset].wallv = walluvs[mask][set + 1];
+  u = walluvs[mask][set];
+  v = walluvs[mask][set + 1];
 }
@@ -6,7 +6,10 @@
 
 class UVRules {
   public:
-    static uint8_t mapTile(const class World &world, int x, int y);
-    static void mapWall(const class World &world, int x, int y);
-    static void mapCactus(const class World &world, int x, int y);
+    // work out the u/v of a tile or wall, without touching the world
+    static uint8_t tileUV(const class World &world, int x, int y, int16_t &u, int16_t &v);
+    static void wallUV(const class World &world, int x, int y, int16_t &u, int16_t &v);
+
+  private:
+    static void cactusUV(const class World &world, int x, int y, int16_t &u, int16_t &v);
 };
@@ -2,8 +2,13 @@
 
 #include "world.h"
 #include "handle.h"
+#include "parallel.h"
+#include "uvrules.h"
+#include <SDL3/SDL.h>
+#include <algorithm>
 #include <string>
 #include <vector>
+#include <cstdlib>
 #include <cstring>
 
 
@@ -19,6 +24,32 @@ bool World::load(const std::string &filename, SDL_Mutex *mutex) {
     return false;
   }
 
+  index.open(filename);
+  try {
+    if (!loadSections(handle, mutex)) {
+      return false;
+    }
+  } catch (HandleError &e) {
+    setProgress("Corrupt world: " + e.reason, mutex);
+    return false;
+  }
+
+  countUsage();
+
+  size_t colorBytes = colors ? static_cast<size_t>(tilesWide) * tilesHigh * 4 : 0;
+  SDL_Log("%dx%d tiles: %zu KB %s, %zu KB of map colors", tilesWide, tilesHigh,
+          tiles.bytes() / 1024, tiles.isChunked() ? "chunked" : "in planes", colorBytes / 1024);
+
+  loaded = true;
+  SDL_AddAtomicInt(&bandsLoaded, 1);  // so npcs get drawn
+
+  setProgress("Done", mutex);
+
+  // we would spread light here
+  return true;
+}
+
+bool World::loadSections(std::shared_ptr<Handle> handle, SDL_Mutex *mutex) {
   auto version = handle->r32();
   setProgress("Loading map version " + std::to_string(version), mutex);
   if (version > MaxVersion) {
@@ -44,47 +75,46 @@ bool World::load(const std::string &filename, SDL_Mutex *mutex) {
     handle->skip(4 + 8);  // revision & favorites
   }
   int numSections = handle->r16();
-  std::vector<int> sections;
+  std::vector<int64_t> sections;
   for (int i = 0; i < numSections; i++) {
     sections.push_back(handle->r32());
   }
-  int numTiles = handle->r16();
-  uint8_t mask = 0x80;
-  uint8_t bits = 0;
-  std::vector<bool> extra;
-  for (int i = 0; i < numTiles; i++) {
-    if (mask == 0x80) {
-      bits = handle->r8();
-      mask = 1;
-    } else {
-      mask <<= 1;
-    }
-    extra.push_back(bits & mask);
+  if (numSections < (version >= 210 ? 9 : 6)) {
+    handle->fail("only " + std::to_string(numSections) + " sections");
   }
+  sections.push_back(handle->length);  // so every section has an end
+  FrameImportant extra;
+  extra.load(*handle);
 
   setProgress("Loading header", mutex);
-  handle->seek(sections[0]);
+  handle->section("header", sections[0], sections[1]);
   loadHeader(handle, version);
+  handle->endSection();
   setProgress("Loading tiles", mutex);
-  handle->seek(sections[1]);
+  handle->section("tiles", sections[1], sections[2]);
   loadTiles(handle, version, extra);
+  handle->endSection();
   setProgress("Loading chests", mutex);
-  handle->seek(sections[2]);
+  handle->section("chests", sections[2], sections[3]);
   loadChests(handle, version);
+  handle->endSection();
   setProgress("Loading signs", mutex);
-  handle->seek(sections[3]);
+  handle->section("signs", sections[3], sections[4]);
   loadSigns(handle);
+  handle->endSection();
   setProgress("Loading npcs", mutex);
-  handle->seek(sections[4]);
+  handle->section("npcs", sections[4], sections[5]);
   loadNPCs(handle, version);
+  handle->endSection();
   setProgress("Loading entities", mutex);
-  handle->seek(sections[5]);
+  handle->section("entities", sections[5], sections[6]);
   if (version >= 116) {
     if (version < 122) {
       loadDummies(handle);
     } else {
       loadEntities(handle);
     }
+    handle->endSection();
   }
   if (version >= 170) {
     // section 6 is pressure plates
@@ -97,19 +127,47 @@ bool World::load(const std::string &filename, SDL_Mutex *mutex) {
   }
   setProgress("Loading bestiary", mutex);
   if (version >= 210) {
-    handle->seek(sections[8]);
+    handle->section("bestiary", sections[8], sections[9]);
     loadBestiary(handle);
+    handle->endSection();
   }
   if (version >= 220) {
     // section 9 is creative powers
   }
+  return true;
+}
 
-  loaded = true;
+void World::reset() {
+  loaded = false;
+  failed = false;
+  SDL_SetAtomicInt(&bandsLoaded, 0);
+  SDL_SetAtomicInt(&bandsColored, 0);
+  SDL_SetAtomicInt(&mipsReady, 0);
+  SDL_SetAtomicInt(&columnsLeft, 0);
+  SDL_SetAtomicInt(&columnsRight, 0);
+}
 
-  setProgress("Done", mutex);
+int World::bands() {
+  return SDL_GetAtomicInt(&bandsLoaded);
+}
 
-  // we would spread light here
-  return true;
+int World::coloredBands() {
+  return SDL_GetAtomicInt(&bandsColored);
+}
+
+int World::mipLevels() {
+  return SDL_GetAtomicInt(&mipsReady);
+}
+
+void World::loadedColumns(int *left, int *right) {
+  *left = SDL_GetAtomicInt(&columnsLeft);
+  *right = SDL_GetAtomicInt(&columnsRight);
+}
+
+void World::landed(int left, int right) {
+  SDL_SetAtomicInt(&columnsLeft, left);
+  SDL_SetAtomicInt(&columnsRight, right);
+  SDL_AddAtomicInt(&bandsLoaded, 1);
 }
 
 void World::setProgress(std::string msg, SDL_Mutex *mutex) {
@@ -126,33 +184,298 @@ void World::loadHeader(std::shared_ptr<Handle> handle, int version) {
   header.load(handle, version);
   tilesHigh = header["tilesHigh"]->toInt();
   tilesWide = header["tilesWide"]->toInt();
+  if (tilesWide <= 0 || tilesHigh <= 0 || tilesWide > 0xffff || tilesHigh > 0xffff) {
+    handle->fail("invalid world size " + std::to_string(tilesWide) + "x" + std::to_string(tilesHigh));
+  }
 
   groundLevel = header["groundLevel"]->toInt();
   rockLevel = header["rockLevel"]->toInt();
   hellLevel = ((tilesHigh - 330) - groundLevel) / 6;
   hellLevel = hellLevel * 6 + groundLevel - 5;
 
-  tiles = new Tile[tilesWide * tilesHigh]();  // () = init to zero
-  colors = new uint8_t[tilesWide * tilesHigh * 4];
+  tiles.resize(tilesWide, tilesHigh, compact || static_cast<int64_t>(tilesWide) * tilesHigh > PlanarTiles);
+  delete [] colors;
+  // () = init to zero, so columns that haven't been colored yet are clear
+  colors = flatColors ? new uint8_t[static_cast<size_t>(tilesWide) * tilesHigh * 4]() : nullptr;
+  mips.clear();
+}
+
+void World::loadTiles(std::shared_ptr<Handle> handle, int version, const FrameImportant &extra) {
+  // the tile stream is sequential, so we need to know where each column starts
+  bool cached = index.load(*handle, tilesWide);
+  if (!cached) {
+    scanColumns(*handle, extra);
+  }
+  try {
+    decodeColumns(*handle, extra, cached);
+  } catch (HandleError &e) {
+    if (!cached) {
+      throw;
+    }
+    // stale index, start over the slow way.  nothing has landed yet, so
+    // we're free to write over what was decoded.
+    SDL_Log("Ignoring tile index: %s", e.reason.c_str());
+    index.remove();
+    scanColumns(*handle, extra);
+    cached = false;
+    decodeColumns(*handle, extra, cached);
+  }
+  buildMips();
+  handle->seek(index.columns[tilesWide]);
+  if (!cached) {
+    index.save();
+  }
 }
 
-void World::loadTiles(std::shared_ptr<Handle> handle, int version, std::vector<bool> &extra) {
+void World::scanColumns(Handle &handle, const FrameImportant &extra) {
+  index.columns.clear();
+  index.columns.reserve(tilesWide + 1);
   for (int x = 0; x < tilesWide; x++) {
-    int offset = x;
+    handle.readAhead();
+    index.columns.push_back(handle.tell());
     for (int y = 0; y < tilesHigh; y++) {
-      int rle = tiles[offset].load(handle, extra);
-      mapColor(tiles[offset], colors + offset * 4, y);  // calculate now so we can take advantage of rle
-      int destOffset = offset + tilesWide;
-      for (int r = 0; r < rle; r++, destOffset += tilesWide) {
-        memcpy(&tiles[destOffset], &tiles[offset], sizeof(Tile));
-        memcpy(colors + destOffset * 4, colors + offset * 4, 4);
+      y += Tile::skip(handle, extra);
+      if (y >= tilesHigh) {
+        handle.fail("tile run past the bottom of column " + std::to_string(x));
+      }
+    }
+  }
+  index.columns.push_back(handle.tell());
+}
+
+// A cached index might be stale, and we only find out by decoding with it,
+// so then everything gets decoded before anything lands.
+void World::decodeColumns(Handle &handle, const FrameImportant &extra, bool cached) {
+  settledLeft = settledRight = 0;
+  if (!progressive || cached) {
+    decodeRange(handle, extra, 0, tilesWide);
+  }
+  if (!progressive) {
+    settle(0, tilesWide);
+    return;
+  }
+  // start with what's on screen at spawn, then grow outwards a band at a time
+  int spawn = std::clamp(header["spawnX"]->toInt(), 0, tilesWide - 1);
+  // bands start on a batch boundary, so batches line up with tile chunks
+  int left = std::max(spawn - SpawnBand / 2, 0) / ColumnBatch * ColumnBatch;
+  int right = std::min(left + SpawnBand, tilesWide);
+  if (!cached) {
+    decodeRange(handle, extra, left, right);
+  }
+  settle(left, right);
+  int band = std::max(SpawnBand, tilesWide / NumBands) / ColumnBatch * ColumnBatch;
+  while (left > 0 || right < tilesWide) {
+    if (right < tilesWide) {
+      int end = std::min(right + band, tilesWide);
+      if (!cached) {
+        decodeRange(handle, extra, right, end);
+      }
+      right = end;
+      settle(left, right);
+    }
+    if (left > 0) {
+      int start = std::max(left - band, 0);
+      if (!cached) {
+        decodeRange(handle, extra, start, left);
       }
-      y += rle;
-      offset = destOffset;
+      left = start;
+      settle(left, right);
     }
   }
 }
 
+// Lets the decoded columns [left, right) land, and colors them.  With
+// resolveUVs on, their u/vs get worked out first.  Columns next to ones
+// that haven't been decoded yet are held back a chunk, since their u/vs
+// depend on those neighbors.  Columns only get written before they land,
+// so nothing writes to a chunk the renderer can see.
+void World::settle(int left, int right) {
+  if (resolveUVs) {
+    left = left > 0 ? left + ColumnBatch : 0;
+    right = right < tilesWide ? right - ColumnBatch : tilesWide;
+  }
+  if (left >= right) {
+    return;
+  }
+  // what's new is on one side or both of what already landed
+  int oldLeft = settledLeft, oldRight = settledRight;
+  if (oldLeft >= oldRight) {
+    oldLeft = oldRight = left;
+  }
+  if (resolveUVs) {
+    resolveRange(left, oldLeft);
+    resolveRange(oldRight, right);
+  }
+  landed(left, right);
+  colorRange(left, oldLeft);
+  colorRange(oldRight, right);
+  settledLeft = left;
+  settledRight = right;
+}
+
+// Works out the u/v of every tile and wall in [left, right) that the world
+// file didn't store, so drawing never has to.  Rules look at neighbors, so
+// everything is worked out before anything is written, then written a band
+// of rows at a time.  Bands are whole chunks, so no two threads write the
+// same one.
+void World::resolveRange(int left, int right) {
+  struct Resolved {
+    int offset;
+    int16_t u, v;
+    bool wall;
+  };
+  int bands = (tilesHigh + RowBatch - 1) / RowBatch;
+  for (; left < right; left += SpawnBand) {
+    int end = std::min(left + SpawnBand, right);
+    std::vector<std::vector<Resolved>> resolved(bands);
+    parallelFor(bands, 1, [&](int start, int stop) {
+      for (int band = start; band < stop; band++) {
+        auto &out = resolved[band];
+        for (int y = band * RowBatch; y < std::min((band + 1) * RowBatch, tilesHigh); y++) {
+          int offset = y * tilesWide + left;
+          for (int x = left; x < end; x++, offset++) {
+            // anything the rules can't place gets the first frame, so
+            // drawing never has to try again
+            int16_t u, v;
+            if (tiles.active(offset) && tiles.u(offset) < 0) {
+              UVRules::tileUV(*this, x, y, u, v);
+              out.push_back({offset, std::max<int16_t>(u, 0), std::max<int16_t>(v, 0), false});
+            }
+            if (tiles.wall(offset) > 0 && tiles.wallu(offset) < 0) {
+              UVRules::wallUV(*this, x, y, u, v);
+              out.push_back({offset, std::max<int16_t>(u, 0), std::max<int16_t>(v, 0), true});
+            }
+          }
+        }
+      }
+    });
+    parallelFor(bands, 1, [&](int start, int stop) {
+      for (int band = start; band < stop; band++) {
+        for (const auto &r : resolved[band]) {
+          if (r.wall) {
+            tiles.setWallUV(r.offset, r.u, r.v);
+          } else {
+            tiles.setUV(r.offset, r.u, r.v);
+          }
+        }
+      }
+    });
+  }
+}
+
+void World::decodeRange(Handle &handle, const FrameImportant &extra, int left, int right) {
+  parallelFor(right - left, ColumnBatch, [&](int start, int end) {
+    start += left;
+    end += left;
+    Handle view(handle, index.columns[start], index.columns[end]);
+    for (int x = start; x < end; x++) {
+      loadColumn(view, x, extra);
+    }
+    if (view.tell() != index.columns[end]) {
+      view.fail("column " + std::to_string(end - 1) + " ended early");
+    }
+  });
+}
+
+// tiles that will get the same flat map color, as long as they're at the same depth
+static bool sameColor(const TileStore &tiles, int a, int b) {
+  return tiles.is(a) == tiles.is(b) && tiles.type(a) == tiles.type(b) && tiles.u(a) == tiles.u(b) &&
+    tiles.v(a) == tiles.v(b) && tiles.wall(a) == tiles.wall(b) && tiles.liquid(a) == tiles.liquid(b);
+}
+
+// The flat map colors are a separate pass over rows rather than part of
+// decoding, since rows split evenly across threads no matter how the
+// columns compress.  It runs after a band has landed, so the textured
+// view never waits on it.  Most tiles match their neighbor to the left or above,
+// so they just copy its color instead of looking up the tile info again.
+void World::colorRange(int left, int right) {
+  if (!colors || left >= right) {
+    return;
+  }
+  parallelFor(tilesHigh, RowBatch, [&](int start, int end) {
+    for (int y = start; y < end; y++) {
+      // rows above this one in the batch are ours to read
+      bool above = y > start && background(y) == background(y - 1);
+      int offset = y * tilesWide + left;
+      for (int x = left; x < right; x++, offset++) {
+        uint8_t *color = colors + offset * 4;
+        if (x > left && sameColor(tiles, offset, offset - 1)) {
+          memcpy(color, color - 4, 4);
+        } else if (above && sameColor(tiles, offset, offset - tilesWide)) {
+          memcpy(color, color - tilesWide * 4, 4);
+        } else {
+          mapColor(tiles[offset], color, y);
+        }
+      }
+    }
+  });
+  SDL_AddAtomicInt(&bandsColored, 1);
+}
+
+void World::countUsage() {
+  int spawnX = header["spawnX"]->toInt(), spawnY = header["spawnY"]->toInt();
+  int batches = (tilesHigh + RowBatch - 1) / RowBatch;
+  std::vector<std::vector<Usage>> tileCounts(batches), wallCounts(batches);
+  parallelFor(tilesHigh, RowBatch, [&](int start, int end) {
+    auto &tileCount = tileCounts[start / RowBatch];
+    auto &wallCount = wallCounts[start / RowBatch];
+    for (int y = start; y < end; y++) {
+      bool nearY = std::abs(y - spawnY) < NearHigh / 2;
+      int offset = y * tilesWide;
+      for (int x = 0; x < tilesWide; x++, offset++) {
+        bool near = nearY && std::abs(x - spawnX) < NearWide / 2;
+        if (tiles.active(offset)) {
+          int type = tiles.type(offset);
+          if (type >= static_cast<int>(tileCount.size())) {
+            tileCount.resize(type + 1);
+          }
+          tileCount[type].total++;
+          tileCount[type].near += near;
+        }
+        if (int wall = tiles.wall(offset); wall > 0) {
+          if (wall >= static_cast<int>(wallCount.size())) {
+            wallCount.resize(wall + 1);
+          }
+          wallCount[wall].total++;
+          wallCount[wall].near += near;
+        }
+      }
+    }
+  });
+  auto merge = [](std::vector<Usage> &usage, const std::vector<std::vector<Usage>> &counts) {
+    usage.clear();
+    for (const auto &count : counts) {
+      if (count.size() > usage.size()) {
+        usage.resize(count.size());
+      }
+      for (size_t i = 0; i < count.size(); i++) {
+        usage[i].total += count[i].total;
+        usage[i].near += count[i].near;
+      }
+    }
+  };
+  merge(tileUsage, tileCounts);
+  merge(wallUsage, wallCounts);
+}
+
+void World::loadColumn(Handle &handle, int x, const FrameImportant &extra) {
+  int offset = x;
+  for (int y = 0; y < tilesHigh; y++) {
+    Tile tile;
+    int rle = tile.load(handle, extra);
+    if (y + rle >= tilesHigh) {  // would spill into the next column
+      handle.fail("tile run past the bottom of column " + std::to_string(x));
+    }
+    tiles.set(offset, tile);
+    int destOffset = offset + tilesWide;
+    for (int r = 0; r < rle; r++, destOffset += tilesWide) {
+      tiles.set(destOffset, tile);
+    }
+    y += rle;
+    offset = destOffset;
+  }
+}
+
 void World::loadChests(std::shared_ptr<Handle> handle, int version) {
   chests.clear();
   int numChests = handle->r16();
@@ -409,46 +732,97 @@ void World::loadBestiary(std::shared_ptr<Handle> handle) {
   }
 }
 
+// mixes liquid over a tile color, alpha is out of 20.  All three channels
+// are done at once, each in its own 16 bits so the products can't overlap.
+static uint32_t blend(uint32_t c, uint32_t lc, int alpha) {
+  uint64_t spread = ((c & 0xff0000ull) << 16) | ((c & 0xff00) << 8) | (c & 0xff);
+  uint64_t lspread = ((lc & 0xff0000ull) << 16) | ((lc & 0xff00) << 8) | (lc & 0xff);
+  uint64_t mix = lspread * alpha + spread * (20 - alpha);
+  return ((mix >> 32 & 0xffff) / 20) << 16 | ((mix >> 16 & 0xffff) / 20) << 8 | (mix & 0xffff) / 20;
+}
+
+// Each level halves the one before it, averaging 2x2 blocks, the same
+// sizes the GPU expects for a mip chain.  Odd rows and columns at the edge
+// get folded into their neighbor, so the last texel averages up to 3x3.
+void World::buildMips() {
+  if (!colors) {
+    return;
+  }
+  const uint8_t *src = colors;
+  int w = tilesWide, h = tilesHigh;
+  while (w > 1 || h > 1) {
+    int mw = std::max(w / 2, 1), mh = std::max(h / 2, 1);
+    auto mip = std::make_unique<uint8_t[]>(static_cast<size_t>(mw) * mh * 4);
+    uint8_t *dest = mip.get();
+    parallelFor(mh, RowBatch, [&](int start, int end) {
+      for (int y = start; y < end; y++) {
+        int y0 = std::min(y * 2, h - 1);
+        int y1 = y == mh - 1 ? h : std::min(y * 2 + 2, h);
+        uint8_t *out = dest + static_cast<size_t>(y) * mw * 4;
+        for (int x = 0; x < mw; x++) {
+          int x0 = std::min(x * 2, w - 1);
+          int x1 = x == mw - 1 ? w : std::min(x * 2 + 2, w);
+          int n = (y1 - y0) * (x1 - x0);
+          uint32_t sum[4] = {0, 0, 0, 0};
+          for (int sy = y0; sy < y1; sy++) {
+            const uint8_t *row = src + (static_cast<size_t>(sy) * w + x0) * 4;
+            for (int sx = x0; sx < x1; sx++) {
+              for (int c = 0; c < 4; c++) {
+                sum[c] += *row++;
+              }
+            }
+          }
+          for (int c = 0; c < 4; c++) {
+            *out++ = (sum[c] + n / 2) / n;
+          }
+        }
+      }
+    });
+    mips.push_back(std::move(mip));
+    src = dest;
+    w = mw;
+    h = mh;
+  }
+  SDL_SetAtomicInt(&mipsReady, mips.size());
+  SDL_AddAtomicInt(&bandsColored, 1);  // so the flat map gets uploaded again, with mips
+}
+
+uint32_t World::background(int y) const {
+  if (y < groundLevel) {
+    return info.sky;
+  }
+  if (y < rockLevel) {
+    return info.earth;
+  }
+  if (y < hellLevel) {
+    return info.rock;
+  }
+  return info.hell;
+}
+
 void World::mapColor(const Tile &tile, uint8_t *color, int y) {
   uint32_t c = 0;
   if (tile.active()) {
     c = info[tile]->color;
   } else if (tile.wall > 0) {
     c = info.walls[tile.wall]->color;
-  } else if (y < groundLevel) {
-    c = info.sky;
-  } else if (y < rockLevel) {
-    c = info.earth;
-  } else if (y < hellLevel) {
-    c = info.rock;
   } else {
-    c = info.hell;
+    c = background(y);
   }
   if (tile.liquid > 0) {
     uint32_t lc = info.water;
-    double alpha = 0.5;
+    int alpha = 10;  // in twentieths
     if (tile.shimmer()) {
-      alpha = 0.85;
+      alpha = 17;
       lc = info.shimmer;
     } else if (tile.honey()) {
-      alpha = 0.85;
+      alpha = 17;
       lc = info.honey;
     } else if (tile.lava()) {
-      alpha = 0.9;
+      alpha = 18;
       lc = info.lava;
     }
-    double r = (c >> 16) / 255.0;
-    double g = ((c >> 8) & 0xff) / 255.0;
-    double b = (c & 0xff) / 255.0;
-    double lr = (lc >> 16) / 255.0;
-    double lg = ((lc >> 8) & 0xff) / 255.0;
-    double lb = (lc & 0xff) / 255.0;
-    r = lr * alpha + r * (1. - alpha);
-    g = lg * alpha + g * (1. - alpha);
-    b = lb * alpha + b * (1. - alpha);
-    c = ((uint32_t)(r * 255) << 16) |
-            ((uint32_t)(g * 255) << 8) |
-            (uint32_t)(b * 255);
+    c = blend(c, lc, alpha);
   }
   *color++ = c >> 16;
   *color++ = (c >> 8) & 0xff;
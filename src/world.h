@@ -2,23 +2,40 @@
 
 #pragma once
 
+#include "SDL3/SDL_atomic.h"
 #include "SDL3/SDL_mutex.h"
 #include "handle.h"
 #include "worldheader.h"
 #include "worldinfo.h"
 #include "tiles.h"
+#include "tilestore.h"
+#include "tileindex.h"
 
 class World {
   public:
     bool load(const std::string &filename, SDL_Mutex *mutex);
     std::string progress();
+    void reset();
+    // tiles become usable a band of columns at a time, before loaded is set.
+    // bands() is 0 until the first band lands, and changes whenever another does.
+    int bands();
+    // the flat map colors for a band land after its tiles do, counted the same way
+    int coloredBands();
+    void loadedColumns(int *left, int *right);
     int tilesWide, tilesHigh;
     WorldInfo info;
     WorldHeader header;
-    Tile *tiles;
-    uint8_t *colors;
+    TileStore tiles;
+    uint8_t *colors = nullptr;  // flat map colors, null if flatColors is off
+    // colors box filtered down to 1/2, 1/4 ... 1x1, for zooming out
+    std::vector<std::unique_ptr<uint8_t[]>> mips;
+    int mipLevels();  // 0 until every band is colored and the mips are built
     bool loaded = false;
     bool failed = false;
+    bool progressive = true;  // decode around spawn first
+    bool compact = false;  // store tiles chunked even if the world isn't huge
+    bool flatColors = true;  // only needed for the zoomed out map
+    bool resolveUVs = true;  // work out every u/v while loading instead of while drawing
 
     struct Chest {
       struct Item {
@@ -94,15 +111,48 @@ class World {
     std::vector<std::string> seen;
     std::vector<std::string> chats;
 
+    // how many of each tile and wall type the world has, counted once it's
+    // loaded.  near only counts the ones in the screenful or so around spawn.
+    struct Usage {
+      uint32_t total = 0, near = 0;
+    };
+    std::vector<Usage> tileUsage, wallUsage;
+    // the box around spawn that counts as near, in tiles
+    static const int NearWide = 256, NearHigh = 128;
+
   private:
+    // columns handed to a decode thread at a time.  A whole chunk, so
+    // chunked tile storage never has two threads writing the same chunk.
+    static const int ColumnBatch = TileStore::ChunkSize;
+    // columns decoded around spawn before anything else
+    static const int SpawnBand = 512;
+    // how many bands the rest of the world loads in
+    static const int NumBands = 16;
+    // rows handed to a thread when computing flat map colors
+    static const int RowBatch = 64;
+    // worlds bigger than a vanilla large world get chunked tile storage
+    static const int PlanarTiles = 8400 * 2400;
+
+    bool loadSections(std::shared_ptr<Handle> handle, SDL_Mutex *mutex);
     void loadHeader(std::shared_ptr<Handle> handle, int version);
-    void loadTiles(std::shared_ptr<Handle> handle, int version, std::vector<bool> &extra);
+    void loadTiles(std::shared_ptr<Handle> handle, int version, const FrameImportant &extra);
+    void scanColumns(Handle &handle, const FrameImportant &extra);
+    void decodeColumns(Handle &handle, const FrameImportant &extra, bool cached);
+    void decodeRange(Handle &handle, const FrameImportant &extra, int left, int right);
+    void settle(int left, int right);
+    void resolveRange(int left, int right);
+    void colorRange(int left, int right);
+    void buildMips();
+    void countUsage();
+    void landed(int left, int right);
+    void loadColumn(Handle &handle, int x, const FrameImportant &extra);
     void loadChests(std::shared_ptr<Handle> handle, int version);
     void loadSigns(std::shared_ptr<Handle> handle);
     void loadNPCs(std::shared_ptr<Handle> handle, int version);
     void loadDummies(std::shared_ptr<Handle> handle);
     void loadEntities(std::shared_ptr<Handle> handle);
     void loadBestiary(std::shared_ptr<Handle> handle);
+    uint32_t background(int y) const;
     void mapColor(const Tile &tile, uint8_t *color, int y);
     void render();
     void setProgress(std::string msg, SDL_Mutex *mutex);
@@ -113,6 +163,9 @@ class World {
     std::unordered_map<uint32_t, bool> shimmered;
 
     int groundLevel, rockLevel, hellLevel;
+    TileIndex index;
+    int settledLeft = 0, settledRight = 0;  // columns that have landed
+    SDL_AtomicInt bandsLoaded {}, bandsColored {}, mipsReady {}, columnsLeft {}, columnsRight {};
 
     std::string player;
     SDL_Mutex *loadLock;
@@ -5,6 +5,7 @@
 #include "tiles.h"
 
 #include <SDL3/SDL.h>
+#include <algorithm>
 #include <memory>
 #include <cassert>
 
@@ -36,6 +37,7 @@ WorldInfo::WorldInfo() {
       const auto &tile = jtiles->at(i);
       tiles[tile->at("id")->asInt()] = std::make_shared<TileInfo>(tile, items);
     }
+    buildLookup();
     const auto jwalls = JSON::parse(walls_json);
     for (int i = 0; i < jwalls->length(); i++) {
       const auto &wall = jwalls->at(i);
@@ -86,19 +88,23 @@ WorldInfo::WorldInfo() {
   }
 }
 
-std::shared_ptr<TileInfo> WorldInfo::operator[](Tile const &tile) const {
+static int interval(const std::vector<uint16_t> &intervals, int value) {
+  return intervals[std::clamp(value + 1, 0, static_cast<int>(intervals.size()) - 1)];
+}
+
+const TileInfo *WorldInfo::operator[](Tile const &tile) const {
+  const auto &entry = lookup.at(tile.type);
+  if (entry.variants.empty()) {
+    return entry.info;
+  }
   auto v = tile.v;
   if (tile.type == TileStatues) {
     v %= 162;
   }
-  return find(tiles.at(tile.type), tile.u, v);
+  return entry.variants[interval(entry.vIntervals, v) * entry.intervalsWide + interval(entry.uIntervals, tile.u)];
 }
 
-std::shared_ptr<TileInfo> WorldInfo::operator[](int16_t type) const {
-  return tiles.at(type);
-}
-
-std::shared_ptr<TileInfo> WorldInfo::find(std::shared_ptr<TileInfo> tile, int16_t u, int16_t v) const {
+const TileInfo *WorldInfo::find(const TileInfo *tile, int16_t u, int16_t v) const {
   for (const auto &var : tile->variants) {
     // must match all restrictions
     if ((var->u < 0 || var->u == u) &&
@@ -107,12 +113,87 @@ std::shared_ptr<TileInfo> WorldInfo::find(std::shared_ptr<TileInfo> tile, int16_
       (var->minv < 0 || var->minv <= v) &&
       (var->maxu < 0 || var->maxu > u) &&
       (var->maxv < 0 || var->maxv > v)) {
-      return find(var, u, v);  // recursive
+      return find(var.get(), u, v);  // recursive
     }
   }
   return tile;  // no variants found
 }
 
+// every u and v where some variant's restriction starts or stops matching
+static void restrictions(const TileInfo &tile, std::vector<int> &us, std::vector<int> &vs) {
+  for (const auto &var : tile.variants) {
+    if (var->u >= 0) {
+      us.push_back(var->u);
+      us.push_back(var->u + 1);
+    }
+    if (var->v >= 0) {
+      vs.push_back(var->v);
+      vs.push_back(var->v + 1);
+    }
+    for (int u : {var->minu, var->maxu}) {
+      if (u >= 0) {
+        us.push_back(u);
+      }
+    }
+    for (int v : {var->minv, var->maxv}) {
+      if (v >= 0) {
+        vs.push_back(v);
+      }
+    }
+    restrictions(*var, us, vs);
+  }
+}
+
+// Turns the points where restrictions change into a map from value to
+// interval, and returns a value inside each interval.
+static std::vector<int> intervals(std::vector<int> &points, std::vector<uint16_t> &map) {
+  std::sort(points.begin(), points.end());
+  points.erase(std::unique(points.begin(), points.end()), points.end());
+  int last = points.empty() ? -1 : points.back();
+  map.resize(last + 2);
+  for (int value = -1; value <= last; value++) {
+    map[value + 1] = std::upper_bound(points.begin(), points.end(), value) - points.begin();
+  }
+  std::vector<int> inside = {-1};  // every point is >= 0
+  inside.insert(inside.end(), points.begin(), points.end());
+  return inside;
+}
+
+void WorldInfo::buildLookup() {
+  int maxType = 0;
+  for (const auto &[id, info] : tiles) {
+    maxType = std::max<int>(maxType, id);
+  }
+  lookup.assign(maxType + 1, Lookup {});
+  for (const auto &[id, info] : tiles) {
+    if (id < 0) {
+      continue;
+    }
+    if (info->stone) {
+      if ((id >> 6) >= static_cast<int>(stoneBits.size())) {
+        stoneBits.resize((id >> 6) + 1);
+      }
+      stoneBits[id >> 6] |= 1ull << (id & 63);
+    }
+    auto &entry = lookup[id];
+    entry.info = info.get();
+    if (info->variants.empty()) {
+      continue;
+    }
+    std::vector<int> us, vs;
+    restrictions(*info, us, vs);
+    auto insideU = intervals(us, entry.uIntervals);
+    auto insideV = intervals(vs, entry.vIntervals);
+    entry.intervalsWide = insideU.size();
+    entry.variants.reserve(insideU.size() * insideV.size());
+    for (int v : insideV) {
+      for (int u : insideU) {
+        entry.variants.push_back(find(info.get(), u, v));
+      }
+    }
+  }
+}
+
 static TileInfo::MergeBlend parseMB(const std::string &tag, bool blend, int *offset) {
   std::string group = "";
   TileInfo::MergeBlend mb;
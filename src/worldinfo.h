@@ -4,6 +4,7 @@
 
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include <memory>
 #include <cstdint>
 #include "json.h"
@@ -51,9 +52,17 @@ class NPC {
 class WorldInfo {
   public:
     WorldInfo();
-    std::shared_ptr<TileInfo> operator[](class Tile const &tile) const;
-    std::shared_ptr<TileInfo> operator[](int16_t type) const;
-    std::shared_ptr<TileInfo> find(std::shared_ptr<TileInfo> tile, int16_t u, int16_t v) const;
+    // the info for a tile, down to the variant its u/v picks
+    const TileInfo *operator[](class Tile const &tile) const;
+    const TileInfo *operator[](int16_t type) const {
+      return lookup.at(type).info;
+    }
+    // stone-like tiles all merge as stone.  A flat bitset, since it's checked
+    // for every neighbor of every tile when working out u/vs.
+    bool stone(int16_t type) const {
+      return type >= 0 && (type >> 6) < static_cast<int>(stoneBits.size()) &&
+        ((stoneBits[type >> 6] >> (type & 63)) & 1);
+    }
 
     std::unordered_map<uint16_t, std::string> items;
     std::unordered_map<uint16_t, std::string> prefixes;
@@ -63,4 +72,25 @@ class WorldInfo {
     std::unordered_map<uint16_t, std::shared_ptr<NPC>> npcsByBanner;
     std::unordered_map<std::string, std::shared_ptr<NPC>> npcsByName;
     uint32_t sky, earth, rock, hell, water, lava, honey, shimmer;
+
+  private:
+    // Tile info by type id.  For types with variants, the u/v restrictions
+    // split the sheet into intervals along each axis, and every frame in
+    // the same pair of intervals resolves to the same variant.  Both are
+    // worked out up front, so a lookup is three array reads and never
+    // walks the variant tree.  Nothing changes after construction, so any
+    // thread can look things up.
+    struct Lookup {
+      const TileInfo *info = nullptr;
+      // the interval each u and v is in, starting from -1.  Anything past
+      // the end is in the last interval.
+      std::vector<uint16_t> uIntervals, vIntervals;
+      int intervalsWide = 0;
+      std::vector<const TileInfo *> variants;  // empty if there are none
+    };
+    void buildLookup();
+    const TileInfo *find(const TileInfo *tile, int16_t u, int16_t v) const;
+
+    std::vector<Lookup> lookup;
+    std::vector<uint64_t> stoneBits;
 };